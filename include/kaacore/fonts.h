@@ -109,6 +109,7 @@ class Font {
     Font(const ResourceReference<FontData>& font_data);
 
     friend class TextNode;
+    friend class NodesSerializer;
     friend std::hash<Font>;
     friend void initialize_fonts();
     friend void uninitialize_fonts();
@@ -130,6 +131,8 @@ class TextNode {
 
     void _update_shape();
 
+    friend class NodesSerializer;
+
   public:
     TextNode();
     ~TextNode();
@@ -254,6 +254,10 @@ calculate_realignment_vector(Alignment alignment, const BoundingBox<T>& bbox)
 bool
 check_point_in_polygon(
     const std::vector<glm::dvec2>& polygon_points, const glm::dvec2 point);
+bool
+check_polygons_overlap(
+    const std::vector<glm::dvec2>& polygon_a,
+    const std::vector<glm::dvec2>& polygon_b);
 
 PolygonType
 classify_polygon(const std::vector<glm::dvec2>& points);
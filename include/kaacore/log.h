@@ -25,7 +25,7 @@ constexpr std::array _log_categories{
     "resources"sv, "resources_manager"sv, "sprites"sv, "window"sv, "geometry"sv,
     "fonts"sv, "timers"sv, "transitions"sv, "node_transitions"sv, "camera"sv,
     "views"sv, "spatial_index"sv, "threading"sv, "utils"sv, "embedded_data"sv,
-    "easings"sv, "shaders"sv,
+    "easings"sv, "shaders"sv, "prefabs"sv, "serialization"sv, "spatial_grid"sv,
     // special-purpose categories
     "other"sv, "app"sv, "wrapper"sv};
 
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace kaacore {
+
+class Node;
+
+// Weak reference to a node attached to scene, it remains safe to use
+// after node is deleted (it simply stops resolving).
+struct NodeHandle {
+    uint32_t index = 0;
+    uint32_t generation = 0;
+
+    inline operator bool() const { return this->generation != 0; }
+    inline bool operator==(const NodeHandle& other) const
+    {
+        return this->index == other.index and
+               this->generation == other.generation;
+    }
+    inline bool operator!=(const NodeHandle& other) const
+    {
+        return not(*this == other);
+    }
+
+    inline uint64_t value() const
+    {
+        return (uint64_t(this->generation) << 32) | this->index;
+    }
+    static inline NodeHandle from_value(const uint64_t value)
+    {
+        return NodeHandle{uint32_t(value), uint32_t(value >> 32)};
+    }
+};
+
+class NodeSlotTable {
+  public:
+    NodeHandle acquire(Node* node);
+    void release(const NodeHandle handle);
+
+    Node* resolve(const NodeHandle handle) const;
+    bool is_valid(const NodeHandle handle) const;
+    size_t size() const;
+
+  private:
+    struct Slot {
+        Node* node = nullptr;
+        uint32_t generation = 1;
+    };
+
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _free_slots;
+};
+
+} // namespace kaacore
+
+namespace std {
+using kaacore::NodeHandle;
+
+template<>
+struct hash<NodeHandle> {
+    size_t operator()(const NodeHandle& handle) const
+    {
+        return std::hash<uint64_t>{}(handle.value());
+    }
+};
+} // namespace std
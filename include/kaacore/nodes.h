@@ -9,6 +9,7 @@
 
 #include "kaacore/fonts.h"
 #include "kaacore/geometry.h"
+#include "kaacore/node_handle.h"
 #include "kaacore/node_ptr.h"
 #include "kaacore/physics.h"
 #include "kaacore/renderer.h"
@@ -78,6 +79,8 @@ class Node {
 
     std::optional<int16_t> z_index();
     void z_index(const std::optional<int16_t>& z_index);
+    // z_index inherited from ancestors if not set on the node itself
+    int16_t absolute_z_index();
 
     Shape shape();
     void shape(const Shape& shape);
@@ -104,6 +107,7 @@ class Node {
     NodeTransitionsManager& transitions_manager();
 
     Scene* const scene() const;
+    NodeHandle handle() const;
     NodePtr parent() const;
     const std::vector<Node*>& children();
     bool is_root() const;
@@ -135,25 +139,36 @@ class Node {
     NodeTransitionsManager _transitions_manager;
 
     Scene* _scene = nullptr;
+    NodeHandle _handle;
     Node* _parent = nullptr;
     std::vector<Node*> _children;
     std::optional<ViewIndexSet> _views = std::nullopt;
 
     std::unique_ptr<ForeignNodeWrapper> _node_wrapper;
 
+    // Dirty state is not propagated to children, instead every
+    // recalculation bumps node's generation, which is compared
+    // against the one stored by children during traversal.
     struct {
         glm::fmat4 value;
         bool is_dirty = true;
+        uint64_t generation = 0;
+        uint64_t parent_generation = 0;
+        uint64_t verified_epoch = 0;
     } _model_matrix;
     struct {
         std::vector<StandardVertexData> computed_vertices;
         bgfx::TextureHandle texture_handle;
         bool is_dirty = true;
+        uint64_t model_generation = 0;
     } _render_data;
     struct {
         ViewIndexSet calculated_views;
         int16_t calculated_z_index;
         bool is_dirty = true;
+        uint64_t generation = 0;
+        uint64_t parent_generation = 0;
+        uint64_t verified_epoch = 0;
     } _ordering_data;
 
     bool _indexable = true;
@@ -169,8 +184,17 @@ class Node {
         const Node* const ancestor = nullptr) const;
     void _recalculate_model_matrix();
     void _recalculate_model_matrix_cumulative();
+    void _refresh_model_matrix();
+    void _refresh_ordering_data();
+    bool _is_spatial_data_outdated();
     void _set_position(const glm::dvec2& position);
     void _set_rotation(const double rotation);
+    bool _set_transformation_batched(
+        const glm::dvec2& position, const double rotation);
+    uint64_t& _transform_epoch() const;
+    uint64_t& _ordering_epoch() const;
+    static uint64_t _next_epoch();
+    static void _commit_batched_transformations(Scene* const scene);
 
     friend class _NodePtrBase;
     friend class NodePtr;
@@ -181,6 +205,8 @@ class Node {
     friend struct HitboxNode;
     friend struct NodeSpatialData;
     friend class SpatialIndex;
+    friend class Prefab;
+    friend class NodesSerializer;
     friend constexpr Node* container_node(const NodeSpatialData*);
 };
 
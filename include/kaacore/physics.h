@@ -11,6 +11,7 @@
 
 #include "kaacore/clock.h"
 #include "kaacore/geometry.h"
+#include "kaacore/node_handle.h"
 #include "kaacore/node_ptr.h"
 #include "kaacore/shapes.h"
 
@@ -27,12 +28,24 @@ constexpr CollisionBitmask collision_bitmask_none = ~CP_ALL_CATEGORIES;
 typedef std::unique_ptr<cpShape, void (*)(cpShape*)> CpShapeUniquePtr;
 
 constexpr HighPrecisionDuration default_simulation_step_size = 10000us; // 0.01s
+constexpr size_t default_simulation_max_steps = 10;
 
 class Node;
 class SpaceNode;
 class BodyNode;
 class HitboxNode;
 
+// Simulation advances in fixed steps, so bodies positions lag behind
+// frame time by up to one step. They can be smoothed out by either
+// interpolating between last two steps (adds one step of latency)
+// or extrapolating from the last one using bodies velocities.
+// Smoothed values are what body nodes report as their position/rotation.
+enum struct PhysicsInterpolation {
+    none = 0,
+    interpolate = 1,
+    extrapolate = 2,
+};
+
 enum struct CollisionPhase {
     begin = 1,
     pre_solve = 2,
@@ -72,6 +85,11 @@ void
 cp_call_post_step_callbacks(
     cpSpace* cp_space, void* space_node_phys_ptr, void* data);
 
+void
+cp_record_collision_event(
+    cpArbiter* cp_arbiter, cpSpace* cp_space, const CollisionPhase phase,
+    const bool with_contact_points);
+
 struct SpatialQueryResultBase {
     NodePtr body_node;
     NodePtr hitbox_node;
@@ -113,6 +131,99 @@ struct PointQueryResult : SpatialQueryResultBase {
         const cpShape* cp_shape, const cpVect point, const double distance);
 };
 
+// Collision recorded without calling any user code, nodes are referenced
+// by handles since they may be deleted before events are processed.
+// Hitbox A always has trigger A of the recording request.
+struct CollisionEvent {
+    CollisionPhase phase;
+    NodeHandle body_a;
+    NodeHandle hitbox_a;
+    NodeHandle body_b;
+    NodeHandle hitbox_b;
+    // range of event's points in buffer's contact_points
+    uint32_t contact_points_offset;
+    uint32_t contact_points_count;
+};
+
+struct CollisionEventsBuffer {
+    std::vector<CollisionEvent> events;
+    std::vector<CollisionContactPoint> contact_points;
+
+    void clear();
+};
+
+// Copy of space simulation state: bodies, sleeping components and
+// cached contacts (used for warm starting the solver). Bodies and hitboxes
+// are referenced by handles, so snapshot can be restored only to the space
+// it was taken from. Snapshot object can be reused to avoid allocations.
+struct SpaceSnapshot {
+    struct BodyState {
+        NodeHandle body;
+        // null for awake bodies
+        NodeHandle sleeping_root;
+        cpVect position;
+        cpVect velocity;
+        cpVect force;
+        cpVect velocity_bias;
+        cpFloat angle;
+        cpFloat angular_velocity;
+        cpFloat torque;
+        cpFloat angular_velocity_bias;
+        cpFloat idle_time;
+        glm::dvec2 previous_position;
+        double previous_rotation;
+        uint64_t previous_state_step;
+    };
+
+    enum struct ArbiterPlacement : uint8_t {
+        cached = 0,
+        listed = 1,
+        sleeping = 2,
+    };
+
+    struct ArbiterState {
+        NodeHandle hitbox_a;
+        NodeHandle hitbox_b;
+        cpVect normal;
+        cpVect surface_velocity;
+        cpFloat elasticity;
+        cpFloat friction;
+        // handlers are owned by space, which outlives its snapshots
+        cpCollisionHandler* handler;
+        cpCollisionHandler* handler_a;
+        cpCollisionHandler* handler_b;
+        cpTimestamp stamp;
+        int state;
+        bool swapped;
+        ArbiterPlacement placement;
+        uint32_t contacts_offset;
+        uint32_t contacts_count;
+    };
+
+    // same layout as chipmunk's cpContact
+    struct ContactState {
+        cpVect r1;
+        cpVect r2;
+        cpFloat normal_mass;
+        cpFloat tangent_mass;
+        cpFloat bounce;
+        cpFloat normal_impulse;
+        cpFloat tangent_impulse;
+        cpFloat bias_impulse;
+        cpFloat bias;
+        cpHashValue hash;
+    };
+
+    NodeHandle space;
+    HighPrecisionDuration time_acc;
+    uint64_t steps_count;
+    cpTimestamp stamp;
+    cpFloat last_step_seconds;
+    std::vector<BodyState> bodies;
+    std::vector<ArbiterState> arbiters;
+    std::vector<ContactState> contacts;
+};
+
 class SpaceNode {
   public:
     void add_post_step_callback(const SpacePostStepFunc& func);
@@ -123,6 +234,17 @@ class SpaceNode {
         uint8_t phases_mask = uint8_t(CollisionPhase::any_phase),
         bool only_non_deleted_nodes = true);
 
+    // Begin and separate phases of collisions between given triggers are
+    // appended to space's events buffer instead of calling a handler.
+    // Unlike handlers, recording doesn't prevent concurrent simulation.
+    // Buffer is never cleared by the engine, it should be drained
+    // once per frame with `clear_collision_events`.
+    void record_collision_events(
+        CollisionTriggerId trigger_a, CollisionTriggerId trigger_b,
+        const bool with_contact_points = false);
+    const CollisionEventsBuffer& collision_events() const;
+    void clear_collision_events();
+
     const std::vector<ShapeQueryResult> query_shape_overlaps(
         const Shape& shape, const CollisionBitmask mask = collision_bitmask_all,
         const CollisionBitmask collision_mask = collision_bitmask_all,
@@ -141,6 +263,57 @@ class SpaceNode {
         const CollisionBitmask collision_mask = collision_bitmask_all,
         const CollisionGroup group = collision_group_none);
 
+    // Variants filling caller-provided buffers, which are cleared first.
+    // Reusing the same buffer between calls avoids allocations once it
+    // grows big enough (including contact points of overlap results).
+    void query_shape_overlaps(
+        std::vector<ShapeQueryResult>& results, const Shape& shape,
+        const CollisionBitmask mask = collision_bitmask_all,
+        const CollisionBitmask collision_mask = collision_bitmask_all,
+        const CollisionGroup group = collision_group_none);
+
+    void query_ray(
+        std::vector<RayQueryResult>& results, const glm::dvec2 ray_start,
+        const glm::dvec2 ray_end, const double radius = 0.,
+        const CollisionBitmask mask = collision_bitmask_all,
+        const CollisionBitmask collision_mask = collision_bitmask_all,
+        const CollisionGroup group = collision_group_none);
+
+    void query_point_neighbors(
+        std::vector<PointQueryResult>& results, const glm::dvec2 point,
+        const double max_distance,
+        const CollisionBitmask mask = collision_bitmask_all,
+        const CollisionBitmask collision_mask = collision_bitmask_all,
+        const CollisionGroup group = collision_group_none);
+
+    // hit closest to the ray start
+    std::optional<RayQueryResult> query_ray_first(
+        const glm::dvec2 ray_start, const glm::dvec2 ray_end,
+        const double radius = 0.,
+        const CollisionBitmask mask = collision_bitmask_all,
+        const CollisionBitmask collision_mask = collision_bitmask_all,
+        const CollisionGroup group = collision_group_none);
+
+    // Nearest hit of every ray from [rays_starts[i], rays_ends[i]] is
+    // written to results[i]. With `use_workers` rays are split across
+    // scene's physics workers (if enabled), which is safe since queries
+    // only read the space, as long as nothing modifies it meanwhile.
+    void query_rays_first(
+        const std::vector<glm::dvec2>& rays_starts,
+        const std::vector<glm::dvec2>& rays_ends,
+        std::vector<std::optional<RayQueryResult>>& results,
+        const double radius = 0.,
+        const CollisionBitmask mask = collision_bitmask_all,
+        const CollisionBitmask collision_mask = collision_bitmask_all,
+        const CollisionGroup group = collision_group_none,
+        const bool use_workers = false);
+
+    std::optional<PointQueryResult> query_point_nearest(
+        const glm::dvec2 point, const double max_distance,
+        const CollisionBitmask mask = collision_bitmask_all,
+        const CollisionBitmask collision_mask = collision_bitmask_all,
+        const CollisionGroup group = collision_group_none);
+
     void gravity(const glm::dvec2& gravity);
     glm::dvec2 gravity();
 
@@ -150,23 +323,91 @@ class SpaceNode {
     void sleeping_threshold(const double threshold);
     double sleeping_threshold();
 
+    // Solver work is split between `threads` threads (0 uses all
+    // available cores). Simulation is deterministic only with single
+    // thread, which is the default. Ignored in scene's deterministic mode.
+    void solver_threads(const size_t threads);
+    size_t solver_threads();
+
+    // more iterations give more accurate (and slower) simulation
+    void iterations(const int iterations);
+    int iterations();
+
+    void step_size(const HighPrecisionDuration step_size);
+    HighPrecisionDuration step_size() const;
+
+    // time exceeding that many steps per frame is dropped, so slow frames
+    // don't cause even more simulation work in the following ones
+    void max_steps_per_frame(const size_t max_steps);
+    size_t max_steps_per_frame() const;
+
+    // With interpolation enabled, position and rotation getters of body
+    // nodes (and their absolute transformations) return the smoothed pose,
+    // not the simulated one. Setters teleport the body to the given value,
+    // so offsetting the value read from getter moves body relative to the
+    // smoothed pose, and writing it back unchanged moves body behind.
+    void interpolation(const PhysicsInterpolation interpolation);
+    PhysicsInterpolation interpolation() const;
+
     bool locked() const;
 
+    // Both saving and restoring snapshot rebuild space's dynamic shapes
+    // index in canonical order, so stepping from the same snapshot gives
+    // the same results every time, including the first time right after
+    // it was saved (with single solver thread). Saving skips it when index
+    // wasn't changed since it was last rebuilt, e.g. right after restoring.
+    // Bodies added after snapshot was taken keep their current state.
+    void save_snapshot(SpaceSnapshot& snapshot);
+    SpaceSnapshot save_snapshot();
+    void restore_snapshot(const SpaceSnapshot& snapshot);
+
   private:
     SpaceNode();
     ~SpaceNode();
 
     void simulate(const HighPrecisionDuration dt);
+    bool _can_simulate_concurrently();
+    void _call_post_step_callbacks();
+    cpShape* _prepare_query_shape(
+        const Shape& shape, const CollisionBitmask mask,
+        const CollisionBitmask collision_mask, const CollisionGroup group);
+    void _store_previous_bodies_state();
+    void _reindex_shapes_canonically(const bool include_static);
+    bool _is_shapes_index_canonical() const;
+    bool _sync_bodies();
+    double _interpolation_alpha() const;
+    double _accumulated_seconds() const;
+
+    static void attach_to_simulation_bulk(const std::vector<Node*>& nodes);
+    void clone_settings(const SpaceNode& source);
 
     cpSpace* _cp_space = nullptr;
     HighPrecisionDuration _time_acc = 0us;
+    HighPrecisionDuration _step_size = default_simulation_step_size;
+    size_t _max_steps = default_simulation_max_steps;
+    PhysicsInterpolation _interpolation = PhysicsInterpolation::none;
+    uint64_t _steps_count = 0;
     std::vector<SpacePostStepFunc> _post_step_callbacks;
+    CollisionEventsBuffer _collision_events;
+    // reused by overlap queries, updated in place when shape type matches
+    CpShapeUniquePtr _query_cp_shape{nullptr, cpShapeFree};
+    // arbiters of restored snapshot point to these contacts
+    std::vector<SpaceSnapshot::ContactState> _restored_contacts;
+    std::vector<cpShape*> _reindexed_shapes;
+    // reset by steps and by adding, removing or reindexing shapes,
+    // shapes moved between indexes by (de)activation change the count
+    bool _shapes_index_canonical = false;
+    int _canonical_dynamic_shapes_count = 0;
 
     friend class Node;
     friend class BodyNode;
     friend class HitboxNode;
     friend class Scene;
+    friend class Prefab;
+    friend class NodesSerializer;
     friend void cp_call_post_step_callbacks(cpSpace*, void*, void*);
+    friend void cp_record_collision_event(
+        cpArbiter*, cpSpace*, const CollisionPhase, const bool);
 };
 
 enum struct BodyNodeType {
@@ -253,9 +494,20 @@ class BodyNode {
 
     void override_simulation_rotation();
     void sync_simulation_rotation() const;
+    SpaceNode* _interpolating_space() const;
+    glm::dvec2 _simulation_position() const;
+    double _simulation_rotation() const;
+
+    void clone_simulation_state(const BodyNode& source);
 
     cpBody* _cp_body = nullptr;
 
+    // state from before the last step, used for interpolation,
+    // valid only when stored right before the latest step of the space
+    glm::dvec2 _previous_position;
+    double _previous_rotation;
+    uint64_t _previous_state_step = 0;
+
     std::optional<double> _damping = std::nullopt;
     std::optional<cpVect> _gravity = std::nullopt;
 
@@ -263,8 +515,11 @@ class BodyNode {
     PositionUpdateCallback _position_update_callback = nullptr;
 
     friend class Node;
+    friend class SpaceNode;
     friend class HitboxNode;
     friend class Scene;
+    friend class Prefab;
+    friend class NodesSerializer;
 
     friend void _velocity_update_wrapper(cpBody*, cpVect, cpFloat, cpFloat);
     friend void _position_update_wrapper(cpBody*, cpFloat);
@@ -273,6 +528,12 @@ class BodyNode {
 CpShapeUniquePtr
 prepare_hitbox_shape(const Shape& shape, const Transformation& transformtion);
 
+// returns false if cp_shape is of different type than shape
+bool
+update_hitbox_shape_in_place(
+    cpShape* cp_shape, const Shape& shape,
+    const Transformation& transformation);
+
 class HitboxNode {
   public:
     SpaceNode* space() const;
@@ -305,13 +566,19 @@ class HitboxNode {
     HitboxNode();
     ~HitboxNode();
 
+    Transformation _shape_transformation() const;
     void update_physics_shape();
+    void recreate_physics_shape();
+    void clone_physics_shape(const HitboxNode& source);
     void attach_to_simulation();
     void detach_from_simulation();
 
     cpShape* _cp_shape = nullptr;
 
     friend class Node;
+    friend class SpaceNode;
+    friend class Prefab;
+    friend class NodesSerializer;
 };
 
 } // namespace kaacore
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "kaacore/node_ptr.h"
+
+namespace kaacore {
+
+class Node;
+
+// Prefab holds a detached copy of captured subtree, instances are cloned
+// from it directly (including already computed text glyphs and physics
+// shapes) instead of being recreated with setters. Spaces keep their
+// settings and bodies their simulation state, including gravity and
+// damping overrides and update callbacks.
+// Transitions and foreign node wrappers are not captured.
+class Prefab {
+  public:
+    Prefab() = default;
+
+    static Prefab capture(const NodePtr node);
+
+    NodeOwnerPtr instantiate() const;
+    std::vector<NodeOwnerPtr> instantiate(const size_t count) const;
+
+    operator bool() const;
+    size_t nodes_count() const;
+
+  private:
+    NodeOwnerPtr _template;
+    size_t _nodes_count = 0;
+
+    static NodeOwnerPtr _clone_subtree(
+        const Node* source_root, size_t* nodes_count = nullptr);
+};
+
+} // namespace kaacore
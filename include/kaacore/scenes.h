@@ -1,14 +1,16 @@
 #pragma once
 
-#include <set>
+#include <memory>
 #include <vector>
 
 #include "kaacore/camera.h"
 #include "kaacore/clock.h"
 #include "kaacore/input.h"
+#include "kaacore/node_handle.h"
 #include "kaacore/nodes.h"
 #include "kaacore/physics.h"
 #include "kaacore/spatial_index.h"
+#include "kaacore/threading.h"
 #include "kaacore/timers.h"
 #include "kaacore/views.h"
 
@@ -16,11 +18,15 @@ namespace kaacore {
 
 class Scene {
   public:
+    // declared before root node, so it outlives it
+    NodeSlotTable node_slots;
     Node root_node;
     ViewsManager views;
     TimersManager timers;
     SpatialIndex spatial_index;
-    std::set<Node*> simulations_registry;
+    // kept in registration order, so spaces are simulated
+    // in the same order every run
+    std::vector<Node*> simulations_registry;
 
     Scene();
     virtual ~Scene();
@@ -37,6 +43,22 @@ class Scene {
     double time_scale() const;
     void time_scale(const double scale);
 
+    // With workers enabled, independent spaces are simulated concurrently.
+    // Spaces with pending post-step callbacks, collision handlers or custom
+    // body update callbacks are always simulated serially, so callbacks are
+    // called on engine thread. Either way post-step callbacks are called
+    // right after the first step space takes, they wait for the next frame
+    // if no step is taken in the current one.
+    size_t physics_workers_count() const;
+    void physics_workers_count(const size_t count);
+
+    // In deterministic mode spaces always use single-threaded solver and
+    // time exceeding steps limit is carried over to next frames instead
+    // of being dropped. State of the simulation then depends only on total
+    // time simulated, not on how it was split into frames.
+    bool deterministic_physics() const;
+    void deterministic_physics(const bool deterministic);
+
     virtual void on_attach();
     virtual void on_enter();
     virtual void update(const Duration dt);
@@ -47,6 +69,15 @@ class Scene {
 
   private:
     double _time_scale = 1.;
+    bool _deterministic_physics = false;
+    bool _is_processing_physics = false;
+    std::unique_ptr<WorkerPool> _physics_workers;
+    // changes of nodes invalidate cached data within their scene only
+    uint64_t _transform_epoch;
+    uint64_t _ordering_epoch;
+
+    friend class Node;
+    friend class SpaceNode;
 };
 
 } // namespace kaacore
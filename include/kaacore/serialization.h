@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "kaacore/node_ptr.h"
+
+namespace kaacore {
+
+// Node trees are stored as a header followed by an array of fixed-size
+// node records (in pre-order) and a data section holding variable-length
+// arrays (8-byte aligned), so the whole file can be memory-mapped and
+// read without parsing. Integers are stored as little-endian.
+std::vector<uint8_t>
+serialize_nodes(const NodePtr root);
+
+NodeOwnerPtr
+deserialize_nodes(const uint8_t* data, const size_t size);
+
+void
+save_nodes(const NodePtr root, const std::string& path);
+
+NodeOwnerPtr
+load_nodes(const std::string& path);
+
+} // namespace kaacore
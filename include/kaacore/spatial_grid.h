@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+
+#include <chipmunk/chipmunk.h>
+
+namespace kaacore {
+
+// Uniform grid implementing chipmunk's cpSpatialIndex interface.
+// Objects are kept in flat arrays and bucketed with counting sort
+// on first query after any modification, which makes updating many
+// fast-moving objects of similar size cheap. Grid cells are hashed
+// into `buckets_count` buckets, so the world is unbounded. Segment
+// queries walk only the cells crossed by the segment.
+cpSpatialIndex*
+make_uniform_grid_index(
+    const double cell_size, const size_t buckets_count,
+    cpSpatialIndexBBFunc bbfunc);
+
+} // namespace kaacore
@@ -1,28 +1,91 @@
 #pragma once
 
-#include <unordered_set>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include <chipmunk/chipmunk.h>
 #include <glm/glm.hpp>
 
 #include "kaacore/geometry.h"
+#include "kaacore/node_handle.h"
 #include "kaacore/node_ptr.h"
+#include "kaacore/spatial_snapshot.h"
+#include "kaacore/views.h"
 
 namespace kaacore {
 
 class Node;
 
+struct NodeRayQueryResult {
+    NodePtr node;
+    glm::dvec2 point;
+    glm::dvec2 normal;
+    // fraction of the ray at which hit occurred
+    double alpha;
+};
+
 struct NodeSpatialData {
     void refresh();
-    bool contains_point(const glm::dvec2 point) const;
+    bool contains_point(const glm::dvec2 point);
+    bool intersect_segment(
+        const glm::dvec2 start, const glm::dvec2 end, double& alpha,
+        glm::dvec2& normal);
+    // shape's bounding points are transformed only when needed
+    const std::vector<glm::dvec2>& transformed_points();
+
+    inline glm::dvec2 transform_vector(const glm::dvec2 vector) const
+    {
+        return this->transform_x_axis * vector.x +
+               this->transform_y_axis * vector.y;
+    }
+    inline glm::dvec2 transform_point(const glm::dvec2 point) const
+    {
+        return this->transform_origin + this->transform_vector(point);
+    }
 
     bool is_dirty = false;
     bool is_indexed = false;
     bool is_phony_indexed = false;
+    bool is_update_pending = false;
+    bool has_shape = false;
+    uint64_t model_generation = 0;
     BoundingBox<double> bounding_box;
-    std::vector<glm::dvec2> bounding_points_transformed;
     uint64_t index_uid;
+    // position in phony index, allows O(1) swap-remove
+    size_t phony_index_position;
+
+    // shape-local to world affine transformation (including
+    // origin realignment) captured by the last refresh
+    glm::dvec2 transform_x_axis;
+    glm::dvec2 transform_y_axis;
+    glm::dvec2 transform_origin;
+    bool are_points_outdated = true;
+    std::vector<glm::dvec2> bounding_points_transformed;
+};
+
+typedef bool (*SpatialQueryVisitorFunc)(Node*, void*);
+typedef std::function<bool(const NodePtr, const NodePtr)> SpatialPairFilterFunc;
+
+enum struct SpatialIndexBackend {
+    bb_tree = 1,
+    // chipmunk's cpSpaceHash
+    space_hash = 2,
+    uniform_grid = 3,
+};
+
+constexpr double default_spatial_index_cell_size = 64.;
+
+struct SpatialIndexStats {
+    uint64_t incremental_updates_count = 0;
+    uint64_t bulk_updates_count = 0;
+    size_t last_updated_nodes_count = 0;
+    double last_dirty_fraction = 0.;
+    bool last_update_was_bulk = false;
 };
 
 class SpatialIndex {
@@ -31,28 +94,167 @@ class SpatialIndex {
     ~SpatialIndex();
 
     void start_tracking(Node* node);
+    void start_tracking(const std::vector<Node*>& nodes);
     void stop_tracking(Node* node);
 
     void update_single(Node* node);
     void refresh_all();
 
+    // Hash-based backends work best when `cell_size` is close
+    // to the size of typical indexed node.
+    SpatialIndexBackend backend() const;
+    double cell_size() const;
+    void backend(
+        const SpatialIndexBackend backend,
+        const double cell_size = default_spatial_index_cell_size);
+
+    // Queued nodes are updated together by flush_updates(). When they
+    // make up at least `bulk_update_threshold` fraction of the index,
+    // the whole index is refreshed and rebuilt at once instead of
+    // reinserting nodes one by one.
+    void queue_update(Node* node);
+    void flush_updates();
+    double bulk_update_threshold() const;
+    void bulk_update_threshold(const double threshold);
+    const SpatialIndexStats& stats() const;
+
+    // Snapshot is an immutable copy of the index, safe to query from
+    // other threads while the index itself keeps changing. With
+    // `snapshots_enabled` set, scene publishes one every frame.
+    void publish_snapshot();
+    std::shared_ptr<const SpatialIndexSnapshot> snapshot() const;
+    bool snapshots_enabled() const;
+    void snapshots_enabled(const bool enabled);
+
     std::vector<NodePtr> query_bounding_box(
         const BoundingBox<double>& bbox, bool include_shapeless = true);
     std::vector<NodePtr> query_bounding_box_for_drawing(
         const BoundingBox<double>& bbox);
+    // index is shared by all views, so this visits the same nodes as
+    // the unfiltered query and drops ones not drawn on any of `views`
+    std::vector<NodePtr> query_bounding_box_for_drawing_filtered(
+        const BoundingBox<double>& bbox, const ViewIndexSet& views);
     std::vector<NodePtr> query_point(const glm::dvec2 point);
 
+    // same as above, but results are not bound to nodes lifetime
+    std::vector<NodeHandle> query_bounding_box_handles(
+        const BoundingBox<double>& bbox, bool include_shapeless = true);
+    std::vector<NodeHandle> query_point_handles(const glm::dvec2 point);
+
+    // Results are sorted by distance between the point and node's
+    // bounding box, nodes without shape are skipped.
+    std::vector<NodePtr> query_nearest(
+        const glm::dvec2 point, const size_t k,
+        const double max_distance = std::numeric_limits<double>::infinity());
+    std::vector<NodePtr> query_radius(
+        const glm::dvec2 point, const double radius);
+
+    // Hits are ordered by distance from `start`. Rays starting
+    // inside a shape hit it at `start`, with normal facing backwards.
+    std::vector<NodeRayQueryResult> query_ray(
+        const glm::dvec2 start, const glm::dvec2 end);
+
+    // Every pair of shaped nodes with overlapping bounding boxes
+    // is reported once (node indexed earlier goes first). With `exact`
+    // flag set, their transformed shapes must overlap as well.
+    std::vector<std::pair<NodePtr, NodePtr>> query_overlapping_pairs(
+        const bool exact = false,
+        const SpatialPairFilterFunc& filter = nullptr);
+
+    // Allocation-free variants, visitor is called with every matching
+    // Node* and returns false to stop the query. Index must not be
+    // modified until the query returns.
+    template<typename Visitor>
+    void query_bounding_box_visit(
+        const BoundingBox<double>& bbox, Visitor&& visitor,
+        bool include_shapeless = true)
+    {
+        this->_query_bounding_box(
+            bbox, include_shapeless, _visitor_trampoline<Visitor>,
+            _erase_visitor(visitor));
+    }
+
+    template<typename Visitor>
+    void query_point_visit(const glm::dvec2 point, Visitor&& visitor)
+    {
+        this->_query_point(
+            point, _visitor_trampoline<Visitor>, _erase_visitor(visitor));
+    }
+
+    // Writes up to `max_results` Node* into `out`,
+    // returns number of written results.
+    template<typename OutputIt>
+    size_t query_bounding_box_into(
+        const BoundingBox<double>& bbox, OutputIt out,
+        const size_t max_results = std::numeric_limits<size_t>::max(),
+        bool include_shapeless = true)
+    {
+        size_t count = 0;
+        if (max_results > 0) {
+            this->query_bounding_box_visit(
+                bbox,
+                [&](Node* node) {
+                    *out++ = node;
+                    return ++count < max_results;
+                },
+                include_shapeless);
+        }
+        return count;
+    }
+
+    template<typename OutputIt>
+    size_t query_point_into(
+        const glm::dvec2 point, OutputIt out,
+        const size_t max_results = std::numeric_limits<size_t>::max())
+    {
+        size_t count = 0;
+        if (max_results > 0) {
+            this->query_point_visit(point, [&](Node* node) {
+                *out++ = node;
+                return ++count < max_results;
+            });
+        }
+        return count;
+    }
+
   private:
-    std::vector<NodeSpatialData*> _query_wrappers(
-        const BoundingBox<double>& bbox);
+    template<typename Visitor>
+    static void* _erase_visitor(Visitor& visitor)
+    {
+        return const_cast<void*>(
+            static_cast<const void*>(std::addressof(visitor)));
+    }
+
+    template<typename Visitor>
+    static bool _visitor_trampoline(Node* node, void* visitor)
+    {
+        return (*static_cast<std::remove_reference_t<Visitor>*>(visitor))(
+            node);
+    }
+
+    void _query_bounding_box(
+        const BoundingBox<double>& bbox, bool include_shapeless,
+        SpatialQueryVisitorFunc visitor_func, void* visitor);
+    void _query_point(
+        const glm::dvec2 point, SpatialQueryVisitorFunc visitor_func,
+        void* visitor);
     void _add_to_cp_index(Node* node);
     void _remove_from_cp_index(Node* node);
     void _add_to_phony_index(Node* node);
     void _remove_from_phony_index(Node* node);
+    void _sync_indexable_state(Node* node);
 
     cpSpatialIndex* _cp_index;
-    std::unordered_set<Node*> _phony_index;
+    SpatialIndexBackend _backend;
+    double _cell_size;
+    std::vector<Node*> _phony_index;
     uint64_t _index_counter;
+    std::vector<Node*> _pending_updates;
+    double _bulk_update_threshold;
+    SpatialIndexStats _stats;
+    std::shared_ptr<const SpatialIndexSnapshot> _snapshot;
+    uint64_t _snapshot_generation;
+    bool _snapshots_enabled;
 };
 
 } // namespace kaacore
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "kaacore/geometry.h"
+#include "kaacore/node_handle.h"
+
+namespace kaacore {
+
+struct SpatialSnapshotEntry {
+    NodeHandle handle;
+    BoundingBox<double> bounding_box;
+    // range of entry's transformed shape points in snapshot's points array,
+    // shapeless nodes have no points
+    uint32_t points_offset;
+    uint32_t points_count;
+};
+
+// Immutable copy of spatial index state, stored as a flat BVH.
+// Since it never changes after construction, any number of threads
+// can query it concurrently without locking. Queries return handles,
+// which must be resolved on the engine thread (nodes may already be
+// gone by the time results are used).
+class SpatialIndexSnapshot {
+  public:
+    SpatialIndexSnapshot(
+        const uint64_t generation, std::vector<SpatialSnapshotEntry>&& entries,
+        std::vector<glm::dvec2>&& points);
+
+    uint64_t generation() const;
+    size_t size() const;
+
+    std::vector<NodeHandle> query_bounding_box(
+        const BoundingBox<double>& bbox, bool include_shapeless = true) const;
+    std::vector<NodeHandle> query_point(const glm::dvec2 point) const;
+
+    // visitor is called with every matching entry
+    // and returns false to stop the query
+    template<typename Visitor>
+    void query_bounding_box_visit(
+        const BoundingBox<double>& bbox, Visitor&& visitor) const
+    {
+        if (this->_nodes.empty()) {
+            return;
+        }
+        uint32_t stack[bvh_max_depth];
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const uint32_t node_index = stack[--stack_size];
+            const auto& bvh_node = this->_nodes[node_index];
+            if (not _check_overlap(bvh_node.bounding_box, bbox)) {
+                continue;
+            }
+            if (bvh_node.entries_count > 0) {
+                const uint32_t end = bvh_node.first + bvh_node.entries_count;
+                for (uint32_t i = bvh_node.first; i < end; i++) {
+                    const auto& entry = this->_entries[i];
+                    if (_check_overlap(entry.bounding_box, bbox) and
+                        not visitor(entry)) {
+                        return;
+                    }
+                }
+            } else {
+                // left child directly follows its parent
+                stack[stack_size++] = bvh_node.first;
+                stack[stack_size++] = node_index + 1;
+            }
+        }
+    }
+
+    bool entry_contains_point(
+        const SpatialSnapshotEntry& entry, const glm::dvec2 point) const;
+
+  private:
+    static constexpr size_t bvh_max_depth = 64;
+
+    struct BVHNode {
+        BoundingBox<double> bounding_box;
+        // leaf: range of entries, inner node: index of right child
+        uint32_t first;
+        uint32_t entries_count;
+    };
+
+    static inline bool _check_overlap(
+        const BoundingBox<double>& a, const BoundingBox<double>& b)
+    {
+        return a.min_x <= b.max_x and b.min_x <= a.max_x and
+               a.min_y <= b.max_y and b.min_y <= a.max_y;
+    }
+
+    uint32_t _build(const uint32_t begin, const uint32_t end);
+
+    uint64_t _generation;
+    std::vector<BVHNode> _nodes;
+    std::vector<SpatialSnapshotEntry> _entries;
+    std::vector<glm::dvec2> _points;
+};
+
+} // namespace kaacore
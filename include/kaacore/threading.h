@@ -1,11 +1,15 @@
 #include <exception>
 #pragma once
 
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <initializer_list>
 #include <mutex>
+#include <thread>
 #include <vector>
 
 #include "kaacore/log.h"
@@ -109,4 +113,38 @@ class AwaitableStateEnum {
     std::mutex _mutex;
 };
 
+// Fixed set of threads for splitting work of a single frame.
+class WorkerPool {
+  public:
+    WorkerPool(const size_t workers_count);
+    ~WorkerPool();
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t workers_count() const;
+
+    // Calls `func` with every index from [0, count) range and blocks
+    // until all calls are done, calling thread takes part in the work.
+    // First exception thrown by `func` is rethrown afterwards.
+    // Not reentrant, `func` must not call parallel_for on the same pool.
+    void parallel_for(
+        const size_t count, const std::function<void(size_t)>& func);
+
+  private:
+    void _worker_loop();
+    void _process_tasks();
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _work_condition;
+    std::condition_variable _done_condition;
+    const std::function<void(size_t)>* _func = nullptr;
+    size_t _tasks_count = 0;
+    std::atomic<size_t> _next_task{0};
+    size_t _busy_workers = 0;
+    uint64_t _batch_id = 0;
+    std::exception_ptr _exception;
+    bool _is_stopping = false;
+};
+
 } // namespace kaacore
@@ -182,6 +182,48 @@ check_point_in_polygon(
     return true;
 }
 
+bool
+_has_separating_axis(
+    const std::vector<glm::dvec2>& polygon_a,
+    const std::vector<glm::dvec2>& polygon_b)
+{
+    const auto project = [](const std::vector<glm::dvec2>& points,
+                            const glm::dvec2 axis) {
+        double min_value = glm::dot(points[0], axis);
+        double max_value = min_value;
+        for (const auto& pt : points) {
+            const double value = glm::dot(pt, axis);
+            min_value = glm::min(min_value, value);
+            max_value = glm::max(max_value, value);
+        }
+        return std::make_pair(min_value, max_value);
+    };
+
+    for (size_t i = 0; i < polygon_a.size(); i++) {
+        const auto edge = polygon_a[(i + 1) % polygon_a.size()] - polygon_a[i];
+        const glm::dvec2 axis{edge.y, -edge.x};
+        const auto [min_a, max_a] = project(polygon_a, axis);
+        const auto [min_b, max_b] = project(polygon_b, axis);
+        if (max_a < min_b or max_b < min_a) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+check_polygons_overlap(
+    const std::vector<glm::dvec2>& polygon_a,
+    const std::vector<glm::dvec2>& polygon_b)
+{
+    if (polygon_a.empty() or polygon_b.empty()) {
+        return false;
+    }
+    // separating axis theorem, both polygons must be convex
+    return not _has_separating_axis(polygon_a, polygon_b) and
+           not _has_separating_axis(polygon_b, polygon_a);
+}
+
 glm::dvec2
 find_points_center(const std::vector<glm::dvec2>& points)
 {
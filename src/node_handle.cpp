@@ -0,0 +1,60 @@
+#include "kaacore/exceptions.h"
+
+#include "kaacore/node_handle.h"
+
+namespace kaacore {
+
+NodeHandle
+NodeSlotTable::acquire(Node* node)
+{
+    KAACORE_ASSERT(node != nullptr, "Cannot acquire handle for null node.");
+    uint32_t index;
+    if (not this->_free_slots.empty()) {
+        index = this->_free_slots.back();
+        this->_free_slots.pop_back();
+    } else {
+        index = this->_slots.size();
+        this->_slots.emplace_back();
+    }
+    auto& slot = this->_slots[index];
+    slot.node = node;
+    return NodeHandle{index, slot.generation};
+}
+
+void
+NodeSlotTable::release(const NodeHandle handle)
+{
+    KAACORE_ASSERT(this->is_valid(handle), "Releasing invalid node handle.");
+    auto& slot = this->_slots[handle.index];
+    slot.node = nullptr;
+    // generation 0 is reserved for null handles
+    if (++slot.generation == 0) {
+        slot.generation = 1;
+    }
+    this->_free_slots.push_back(handle.index);
+}
+
+Node*
+NodeSlotTable::resolve(const NodeHandle handle) const
+{
+    if (not this->is_valid(handle)) {
+        return nullptr;
+    }
+    return this->_slots[handle.index].node;
+}
+
+bool
+NodeSlotTable::is_valid(const NodeHandle handle) const
+{
+    return handle and handle.index < this->_slots.size() and
+           this->_slots[handle.index].generation == handle.generation and
+           this->_slots[handle.index].node != nullptr;
+}
+
+size_t
+NodeSlotTable::size() const
+{
+    return this->_slots.size() - this->_free_slots.size();
+}
+
+} // namespace kaacore
@@ -21,6 +21,18 @@ const int16_t default_root_z_index = 0;
 const ViewIndexSet default_root_views =
     std::unordered_set<int16_t>{views_default_z_index};
 
+namespace {
+// Epochs are bumped on every change of transformation (or ordering) data
+// of any node in a scene, node which was verified during current epoch
+// of its scene can skip walking through its ancestors. All epochs are
+// drawn from single counter, so epoch verified in one scene (or while
+// detached) never matches current epoch of another one.
+uint64_t epochs_counter = 0;
+uint64_t detached_transform_epoch = ++epochs_counter;
+uint64_t detached_ordering_epoch = ++epochs_counter;
+uint64_t generations_counter = 0;
+} // namespace
+
 inline double
 _normalize_angle(const double angle)
 {
@@ -57,6 +69,10 @@ Node::~Node()
         delete this->_children[0];
     }
 
+    if (this->_handle) {
+        this->_scene->node_slots.release(this->_handle);
+    }
+
     if (this->_type == NodeType::space) {
         if (this->_scene) {
             this->_scene->unregister_simulation(this);
@@ -74,25 +90,42 @@ Node::~Node()
 void
 Node::_mark_dirty()
 {
+    // children will notice the change by comparing generations
     this->_render_data.is_dirty = true;
     this->_model_matrix.is_dirty = true;
     this->_spatial_data.is_dirty = true;
-    for (auto child : this->_children) {
-        if (not child->_model_matrix.is_dirty) {
-            child->_mark_dirty();
-        }
-    }
+    this->_transform_epoch() = Node::_next_epoch();
 }
 
 void
 Node::_mark_ordering_dirty()
 {
     this->_ordering_data.is_dirty = true;
-    for (auto child : this->_children) {
-        if (not child->_ordering_data.is_dirty) {
-            child->_mark_ordering_dirty();
-        }
+    this->_ordering_epoch() = Node::_next_epoch();
+}
+
+uint64_t
+Node::_next_epoch()
+{
+    return ++epochs_counter;
+}
+
+uint64_t&
+Node::_transform_epoch() const
+{
+    if (this->_scene) {
+        return this->_scene->_transform_epoch;
+    }
+    return detached_transform_epoch;
+}
+
+uint64_t&
+Node::_ordering_epoch() const
+{
+    if (this->_scene) {
+        return this->_scene->_ordering_epoch;
     }
+    return detached_ordering_epoch;
 }
 
 void
@@ -107,6 +140,9 @@ Node::_mark_to_delete()
         this->_node_wrapper->on_detach();
     }
     this->_scene->spatial_index.stop_tracking(this);
+    // handles go stale right away, before node is actually deleted
+    this->_scene->node_slots.release(this->_handle);
+    this->_handle = NodeHandle{};
     for (auto child : this->_children) {
         child->_mark_to_delete();
     }
@@ -158,27 +194,76 @@ void
 Node::_recalculate_model_matrix()
 {
     const static glm::fmat4 identity(1.0);
-    this->_model_matrix.value = this->_compute_model_matrix(
-        this->_parent ? this->_parent->_model_matrix.value : identity);
+    if (this->_parent) {
+        this->_model_matrix.value =
+            this->_compute_model_matrix(this->_parent->_model_matrix.value);
+        this->_model_matrix.parent_generation =
+            this->_parent->_model_matrix.generation;
+    } else {
+        this->_model_matrix.value = this->_compute_model_matrix(identity);
+        this->_model_matrix.parent_generation = 0;
+    }
+    this->_model_matrix.generation = ++generations_counter;
     this->_model_matrix.is_dirty = false;
 }
 
+void
+Node::_refresh_model_matrix()
+{
+    // assumes that parent's model matrix is already refreshed,
+    // which is the case in top-down traversal
+    if (this->_model_matrix.is_dirty or
+        (this->_parent and this->_parent->_model_matrix.generation !=
+                               this->_model_matrix.parent_generation)) {
+        this->_recalculate_model_matrix();
+    }
+
+    const auto epoch = this->_transform_epoch();
+    if (this->_parent == nullptr or
+        this->_parent->_model_matrix.verified_epoch == epoch) {
+        this->_model_matrix.verified_epoch = epoch;
+    }
+}
+
 void
 Node::_recalculate_model_matrix_cumulative()
 {
+    const auto epoch = this->_transform_epoch();
+    if (this->_model_matrix.verified_epoch == epoch) {
+        return;
+    }
+
+    if (this->_parent == nullptr or
+        this->_parent->_model_matrix.verified_epoch == epoch) {
+        // common case, only this node was not verified yet
+        this->_refresh_model_matrix();
+        return;
+    }
+
+    // reused, so walking the ancestors doesn't allocate
+    thread_local std::vector<Node*> inheritance_chain;
+    inheritance_chain.clear();
     Node* pointer = this;
-    std::vector<Node*> inheritance_chain{pointer};
-    while ((pointer = pointer->_parent) != nullptr and
-           pointer->_model_matrix.is_dirty) {
+    do {
         inheritance_chain.push_back(pointer);
-    }
+    } while ((pointer = pointer->_parent) != nullptr and
+             pointer->_model_matrix.verified_epoch != epoch);
 
     for (auto it = inheritance_chain.rbegin(); it != inheritance_chain.rend();
          it++) {
-        (*it)->_recalculate_model_matrix();
+        (*it)->_refresh_model_matrix();
     }
 }
 
+bool
+Node::_is_spatial_data_outdated()
+{
+    this->_recalculate_model_matrix_cumulative();
+    return (
+        this->_spatial_data.is_dirty or this->_spatial_data.model_generation !=
+                                            this->_model_matrix.generation);
+}
+
 void
 Node::_set_position(const glm::dvec2& position)
 {
@@ -198,6 +283,31 @@ Node::_set_rotation(const double rotation)
     this->_rotation = normalized_rotation;
 }
 
+bool
+Node::_set_transformation_batched(
+    const glm::dvec2& position, const double rotation)
+{
+    // same as setting position and rotation, but transform epoch is
+    // bumped once for the whole batch by _commit_batched_transformations
+    const auto normalized_rotation = _normalize_angle(rotation);
+    if (position == this->_position and
+        normalized_rotation == this->_rotation) {
+        return false;
+    }
+    this->_position = position;
+    this->_rotation = normalized_rotation;
+    this->_render_data.is_dirty = true;
+    this->_model_matrix.is_dirty = true;
+    this->_spatial_data.is_dirty = true;
+    return true;
+}
+
+void
+Node::_commit_batched_transformations(Scene* const scene)
+{
+    scene->_transform_epoch = Node::_next_epoch();
+}
+
 NodePtr
 Node::add_child(NodeOwnerPtr& owned_ptr)
 {
@@ -207,53 +317,74 @@ Node::add_child(NodeOwnerPtr& owned_ptr)
     auto child_node = owned_ptr.release();
     child_node->_parent = this;
     this->_children.push_back(child_node.get());
+    // data cached before attaching is no longer valid
+    child_node->_mark_dirty();
+    child_node->_mark_ordering_dirty();
 
     if (child_node->_node_wrapper) {
         child_node->_node_wrapper->on_add_to_parent();
     }
 
     // TODO set root
-    // TODO optimize (replace with iterator?)
-    std::function<void(Node*)> initialize_node;
-    initialize_node = [&initialize_node, this](Node* n) {
+    // walk the attached subtree in pre-order (parents before children)
+    // and collect nodes requiring initialization, so they can be passed
+    // to spatial index and simulation in bulk
+    std::vector<Node*> added_nodes;
+    std::vector<Node*> physics_nodes;
+    std::vector<Node*> nodes_stack{child_node.get()};
+    while (not nodes_stack.empty()) {
+        Node* n = nodes_stack.back();
+        nodes_stack.pop_back();
+
         bool added_to_scene =
             (n->_scene == nullptr and this->_scene != nullptr);
         n->_scene = this->_scene;
         if (added_to_scene) {
-            n->_scene->spatial_index.start_tracking(n);
+            added_nodes.push_back(n);
+        }
+        if (n->_type == NodeType::body or n->_type == NodeType::hitbox) {
+            physics_nodes.push_back(n);
+        }
+        nodes_stack.insert(
+            nodes_stack.end(), n->_children.rbegin(), n->_children.rend());
+    }
+
+    if (not added_nodes.empty()) {
+        this->_scene->spatial_index.start_tracking(added_nodes);
+        for (auto n : added_nodes) {
+            n->_handle = n->_scene->node_slots.acquire(n);
             if (n->_node_wrapper) {
                 n->_node_wrapper->on_attach();
             }
+            if (n->_type == NodeType::space) {
+                n->_scene->register_simulation(n);
+            }
         }
-        if (added_to_scene and n->_type == NodeType::space) {
-            n->_scene->register_simulation(n);
-        } else if (n->_type == NodeType::body) {
-            n->body.attach_to_simulation();
-        } else if (n->_type == NodeType::hitbox) {
-            n->hitbox.update_physics_shape();
-        }
-
-        std::for_each(
-            n->_children.begin(), n->_children.end(), initialize_node);
-    };
-
-    initialize_node(child_node.get());
+    }
+    if (child_node->_type == NodeType::hitbox) {
+        // physics shape depends on parent's scale, shapes of
+        // hitboxes deeper in the subtree remain valid
+        child_node->hitbox.recreate_physics_shape();
+    }
+    if (not physics_nodes.empty()) {
+        SpaceNode::attach_to_simulation_bulk(physics_nodes);
+    }
     return child_node;
 }
 
 void
 Node::recalculate_model_matrix()
 {
-    if (not this->_model_matrix.is_dirty) {
-        return;
-    }
-    this->_recalculate_model_matrix();
+    this->_recalculate_model_matrix_cumulative();
 }
 
 void
 Node::recalculate_render_data()
 {
-    if (not this->_render_data.is_dirty) {
+    this->_recalculate_model_matrix_cumulative();
+    if (not this->_render_data.is_dirty and
+        this->_render_data.model_generation ==
+            this->_model_matrix.generation) {
         return;
     }
 
@@ -282,13 +413,54 @@ Node::recalculate_render_data()
         this->_render_data.texture_handle =
             get_engine()->renderer->default_texture;
     }
+    this->_render_data.model_generation = this->_model_matrix.generation;
     this->_render_data.is_dirty = false;
 }
 
 void
 Node::recalculate_ordering_data()
 {
-    if (not this->_ordering_data.is_dirty) {
+    const auto epoch = this->_ordering_epoch();
+    if (this->_ordering_data.verified_epoch == epoch) {
+        return;
+    }
+
+    if (this->_parent == nullptr or
+        this->_parent->_ordering_data.verified_epoch == epoch) {
+        // common case, only this node was not verified yet
+        this->_refresh_ordering_data();
+        return;
+    }
+
+    // reused, so walking the ancestors doesn't allocate
+    thread_local std::vector<Node*> inheritance_chain;
+    inheritance_chain.clear();
+    Node* pointer = this;
+    do {
+        inheritance_chain.push_back(pointer);
+    } while ((pointer = pointer->_parent) != nullptr and
+             pointer->_ordering_data.verified_epoch != epoch);
+
+    for (auto it = inheritance_chain.rbegin(); it != inheritance_chain.rend();
+         it++) {
+        (*it)->_refresh_ordering_data();
+    }
+}
+
+void
+Node::_refresh_ordering_data()
+{
+    // assumes that parent's ordering data is already refreshed
+    const auto epoch = this->_ordering_epoch();
+    if (this->_parent == nullptr or
+        this->_parent->_ordering_data.verified_epoch == epoch) {
+        this->_ordering_data.verified_epoch = epoch;
+    }
+
+    if (not this->_ordering_data.is_dirty and
+        (this->_parent == nullptr or
+         this->_parent->_ordering_data.generation ==
+             this->_ordering_data.parent_generation)) {
         return;
     }
 
@@ -300,7 +472,6 @@ Node::recalculate_ordering_data()
         KAACORE_ASSERT(
             this->_parent != nullptr,
             "Can't inherit view data if node has no parent");
-        this->_parent->recalculate_ordering_data();
         this->_ordering_data.calculated_views =
             this->_parent->_ordering_data.calculated_views;
     }
@@ -316,6 +487,9 @@ Node::recalculate_ordering_data()
         this->_ordering_data.calculated_z_index =
             this->_parent->_ordering_data.calculated_z_index;
     }
+    this->_ordering_data.parent_generation =
+        this->_parent ? this->_parent->_ordering_data.generation : 0;
+    this->_ordering_data.generation = ++generations_counter;
     this->_ordering_data.is_dirty = false;
 }
 
@@ -357,9 +531,7 @@ Node::position(const glm::dvec2& position)
 glm::dvec2
 Node::absolute_position()
 {
-    if (this->_model_matrix.is_dirty) {
-        this->_recalculate_model_matrix_cumulative();
-    }
+    this->_recalculate_model_matrix_cumulative();
 
     glm::fvec4 pos = {0., 0., 0., 1.};
     pos = this->_model_matrix.value * pos;
@@ -391,9 +563,7 @@ Node::rotation()
 double
 Node::absolute_rotation()
 {
-    if (this->_model_matrix.is_dirty) {
-        this->_recalculate_model_matrix_cumulative();
-    }
+    this->_recalculate_model_matrix_cumulative();
 
     return DecomposedTransformation<float>(this->_model_matrix.value).rotation;
 }
@@ -418,9 +588,7 @@ Node::scale()
 glm::dvec2
 Node::absolute_scale()
 {
-    if (this->_model_matrix.is_dirty) {
-        this->_recalculate_model_matrix_cumulative();
-    }
+    this->_recalculate_model_matrix_cumulative();
 
     return DecomposedTransformation<float>(this->_model_matrix.value).scale;
 }
@@ -446,9 +614,7 @@ Node::scale(const glm::dvec2& scale)
 Transformation
 Node::absolute_transformation()
 {
-    if (this->_model_matrix.is_dirty) {
-        this->_recalculate_model_matrix_cumulative();
-    }
+    this->_recalculate_model_matrix_cumulative();
     return Transformation{this->_model_matrix.value};
 }
 
@@ -492,6 +658,13 @@ Node::z_index(const std::optional<int16_t>& z_index)
     this->_mark_ordering_dirty();
 }
 
+int16_t
+Node::absolute_z_index()
+{
+    this->recalculate_ordering_data();
+    return this->_ordering_data.calculated_z_index;
+}
+
 Shape
 Node::shape()
 {
@@ -625,6 +798,12 @@ Node::scene() const
     return this->_scene;
 }
 
+NodeHandle
+Node::handle() const
+{
+    return this->_handle;
+}
+
 NodePtr
 Node::parent() const
 {
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <type_traits>
 
 #include <chipmunk/chipmunk.h>
@@ -11,6 +13,8 @@ extern "C"
 // this header does not have 'extern "C"' on it's own
 // but on Visual Studio it's built as C++
 #include <chipmunk/chipmunk_private.h>
+#include <chipmunk/chipmunk_unsafe.h>
+#include <chipmunk/cpHastySpace.h>
 
 #ifndef _MSC_VER
 }
@@ -22,6 +26,7 @@ extern "C"
 #include "kaacore/geometry.h"
 #include "kaacore/log.h"
 #include "kaacore/nodes.h"
+#include "kaacore/scenes.h"
 #include "kaacore/utils.h"
 
 #include "kaacore/physics.h"
@@ -199,7 +204,9 @@ PointQueryResult::PointQueryResult(
 
 SpaceNode::SpaceNode()
 {
-    this->_cp_space = cpSpaceNew();
+    // hasty space behaves exactly like regular one
+    // until more than one solver thread is requested
+    this->_cp_space = cpHastySpaceNew();
     KAACORE_LOG_DEBUG(
         "Creating space node {} (cpSpace: {})", fmt::ptr(container_node(this)),
         fmt::ptr(this->_cp_space));
@@ -232,12 +239,15 @@ SpaceNode::~SpaceNode()
         [](void* elt, void* data) {
             auto cp_handler = static_cast<cpCollisionHandler*>(elt);
             // we assume that every collision handler is created by kaacore
-            // since we blindly cast void* to CollisionHandlerFunc*
-            _release_cp_collision_handler_callback(cp_handler);
+            // since we blindly cast void* to CollisionHandlerFunc*,
+            // recording handlers have no function attached
+            if (cp_handler->userData != nullptr) {
+                _release_cp_collision_handler_callback(cp_handler);
+            }
         },
         nullptr);
 
-    cpSpaceFree(this->_cp_space);
+    cpHastySpaceFree(this->_cp_space);
     this->_cp_space = nullptr;
 }
 
@@ -246,10 +256,7 @@ cp_call_post_step_callbacks(
     cpSpace* cp_space, void* space_node_phys_ptr, void* data)
 {
     SpaceNode* space_node_phys = static_cast<SpaceNode*>(space_node_phys_ptr);
-    for (const auto& func : space_node_phys->_post_step_callbacks) {
-        func(space_node_phys);
-    }
-    space_node_phys->_post_step_callbacks.clear();
+    space_node_phys->_call_post_step_callbacks();
 }
 
 void
@@ -262,6 +269,21 @@ SpaceNode::add_post_step_callback(const SpacePostStepFunc& func)
     this->_post_step_callbacks.push_back(func);
 }
 
+void
+SpaceNode::_call_post_step_callbacks()
+{
+    // bring nodes up to date with the step that was just taken,
+    // callbacks may read their (absolute) transformations
+    Scene* scene = container_node(this)->_scene;
+    if (scene != nullptr and this->_sync_bodies()) {
+        Node::_commit_batched_transformations(scene);
+    }
+    for (const auto& func : this->_post_step_callbacks) {
+        func(this);
+    }
+    this->_post_step_callbacks.clear();
+}
+
 void
 SpaceNode::simulate(const HighPrecisionDuration dt)
 {
@@ -269,17 +291,223 @@ SpaceNode::simulate(const HighPrecisionDuration dt)
     KAACORE_LOG_TRACE(
         "Simulating SpaceNode({}) physics, dt = {}", fmt::ptr(this),
         dt.count());
+    const Scene* scene = container_node(this)->_scene;
+    const bool deterministic =
+        scene != nullptr and scene->_deterministic_physics;
+    const auto step_seconds =
+        std::chrono::duration_cast<Duration>(this->_step_size).count();
     auto time_left = dt + this->_time_acc;
-    while (time_left > default_simulation_step_size) {
-        cpSpaceStep(
-            this->_cp_space,
-            std::chrono::duration_cast<Duration>(default_simulation_step_size)
-                .count());
-        time_left -= default_simulation_step_size;
+    size_t steps = 0;
+    while (time_left > this->_step_size and steps < this->_max_steps) {
+        const bool is_last_step = time_left - this->_step_size <=
+                                      this->_step_size or
+                                  steps + 1 == this->_max_steps;
+        if (is_last_step and
+            this->_interpolation == PhysicsInterpolation::interpolate) {
+            this->_store_previous_bodies_state();
+        }
+        if (deterministic) {
+            // unlike hasty step, it never splits solver work between threads
+            cpSpaceStep(this->_cp_space, step_seconds);
+        } else {
+            cpHastySpaceStep(this->_cp_space, step_seconds);
+        }
+        time_left -= this->_step_size;
+        this->_steps_count++;
+        steps++;
+        this->_shapes_index_canonical = false;
+    }
+    if (time_left > this->_step_size and not deterministic) {
+        KAACORE_LOG_DEBUG(
+            "SpaceNode({}) reached steps limit, dropping {} us of simulation",
+            fmt::ptr(this),
+            (time_left - time_left % this->_step_size).count());
+        time_left %= this->_step_size;
     }
     this->_time_acc = time_left;
 }
 
+bool
+SpaceNode::_sync_bodies()
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    // static bodies are kept separately and never move
+    bool any_moved = false;
+    auto sync_body = [&any_moved](cpBody* cp_body) {
+        auto body = static_cast<BodyNode*>(cpBodyGetUserData(cp_body));
+        if (body != nullptr and
+            container_node(body)->_set_transformation_batched(
+                body->_simulation_position(), body->_simulation_rotation())) {
+            any_moved = true;
+        }
+    };
+    const cpArray* cp_bodies = this->_cp_space->dynamicBodies;
+    for (int i = 0; i < cp_bodies->num; i++) {
+        sync_body(static_cast<cpBody*>(cp_bodies->arr[i]));
+    }
+    // bodies that fell asleep during the step were moved out of
+    // dynamicBodies, their nodes may still hold pose from before
+    // (or the smoothed one), sleeping ones are synced to raw pose
+    const cpArray* cp_components = this->_cp_space->sleepingComponents;
+    for (int i = 0; i < cp_components->num; i++) {
+        for (auto cp_body = static_cast<cpBody*>(cp_components->arr[i]);
+             cp_body != nullptr; cp_body = cp_body->sleeping.next) {
+            sync_body(cp_body);
+        }
+    }
+    return any_moved;
+}
+
+double
+SpaceNode::_interpolation_alpha() const
+{
+    // accumulated time exceeds single step when it's carried over
+    return std::min(
+        double(this->_time_acc.count()) / this->_step_size.count(), 1.);
+}
+
+double
+SpaceNode::_accumulated_seconds() const
+{
+    return std::chrono::duration_cast<Duration>(
+               std::min(this->_time_acc, this->_step_size))
+        .count();
+}
+
+void
+SpaceNode::_store_previous_bodies_state()
+{
+    cpSpaceEachBody(
+        this->_cp_space,
+        [](cpBody* cp_body, void* data) {
+            auto body = static_cast<BodyNode*>(cpBodyGetUserData(cp_body));
+            if (body == nullptr) {
+                return;
+            }
+            body->_previous_position =
+                convert_vector(cpBodyGetPosition(cp_body));
+            body->_previous_rotation = cpBodyGetAngle(cp_body);
+            body->_previous_state_step =
+                static_cast<SpaceNode*>(data)->_steps_count + 1;
+        },
+        this);
+}
+
+bool
+SpaceNode::_can_simulate_concurrently()
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    // pending post-step callbacks are called right after the next step,
+    // same as collision handlers and custom body updates running in the
+    // middle of it, they must be called on engine thread (recording
+    // handlers touch only this space's events buffer)
+    if (not this->_post_step_callbacks.empty()) {
+        return false;
+    }
+    bool has_collision_funcs = false;
+    cpHashSetEach(
+        this->_cp_space->collisionHandlers,
+        [](void* elt, void* data) {
+            if (static_cast<cpCollisionHandler*>(elt)->userData != nullptr) {
+                *static_cast<bool*>(data) = true;
+            }
+        },
+        &has_collision_funcs);
+    if (has_collision_funcs) {
+        return false;
+    }
+    bool has_custom_updates = false;
+    cpSpaceEachBody(
+        this->_cp_space,
+        [](cpBody* cp_body, void* data) {
+            if (cp_body->velocity_func != cpBodyUpdateVelocity or
+                cp_body->position_func != cpBodyUpdatePosition) {
+                *static_cast<bool*>(data) = true;
+            }
+        },
+        &has_custom_updates);
+    return not has_custom_updates;
+}
+
+void
+SpaceNode::attach_to_simulation_bulk(const std::vector<Node*>& nodes)
+{
+    // chipmunk objects are grouped per space, so locked space
+    // gets a single deferred callback instead of one for each node
+    struct PendingAttachments {
+        SpaceNode* space_node_phys;
+        std::vector<cpBody*> bodies;
+        std::vector<std::pair<cpBody*, cpShape*>> shapes;
+    };
+    std::vector<PendingAttachments> pending_attachments;
+    auto get_pending = [&pending_attachments](
+                           SpaceNode* space_node_phys) -> PendingAttachments& {
+        for (auto& pending : pending_attachments) {
+            if (pending.space_node_phys == space_node_phys) {
+                return pending;
+            }
+        }
+        return pending_attachments.emplace_back(
+            PendingAttachments{space_node_phys, {}, {}});
+    };
+
+    for (auto node : nodes) {
+        if (node->_type == NodeType::body) {
+            ASSERT_VALID_BODY_NODE(&node->body);
+            if (cpBodyGetSpace(node->body._cp_body) != nullptr) {
+                continue;
+            }
+            KAACORE_ASSERT(
+                node->_parent != nullptr, "Node must have a parent in order "
+                                          "to attach it to the simulation.");
+            ASSERT_VALID_SPACE_NODE(&node->_parent->space);
+            get_pending(&node->_parent->space)
+                .bodies.push_back(node->body._cp_body);
+        } else if (node->_type == NodeType::hitbox) {
+            if (node->hitbox._cp_shape == nullptr) {
+                node->hitbox.recreate_physics_shape();
+            } else if (cpShapeGetSpace(node->hitbox._cp_shape) != nullptr) {
+                continue;
+            }
+            Node* body_node = node->_parent;
+            if (body_node == nullptr or body_node->_parent == nullptr) {
+                // hitbox won't be added to any space, nothing to group
+                if (body_node != nullptr) {
+                    node->hitbox.attach_to_simulation();
+                }
+                continue;
+            }
+            ASSERT_VALID_BODY_NODE(&body_node->body);
+            ASSERT_VALID_SPACE_NODE(&body_node->_parent->space);
+            get_pending(&body_node->_parent->space)
+                .shapes.emplace_back(
+                    body_node->body._cp_body, node->hitbox._cp_shape);
+        }
+    }
+
+    for (auto& pending : pending_attachments) {
+        pending.space_node_phys->_shapes_index_canonical = false;
+        KAACORE_LOG_DEBUG(
+            "Attaching {} bodies and {} shapes to simulation (space) {}",
+            pending.bodies.size(), pending.shapes.size(),
+            fmt::ptr(container_node(pending.space_node_phys)));
+        space_safe_call(
+            pending.space_node_phys,
+            [bodies = std::move(pending.bodies),
+             shapes = std::move(pending.shapes)](
+                const SpaceNode* space_node_phys) {
+                for (auto cp_body : bodies) {
+                    cpSpaceAddBody(space_node_phys->_cp_space, cp_body);
+                }
+                // shapes can be added only after their bodies
+                for (const auto& [cp_body, cp_shape] : shapes) {
+                    cpShapeSetBody(cp_shape, cp_body);
+                    cpSpaceAddShape(space_node_phys->_cp_space, cp_shape);
+                }
+            });
+    }
+}
+
 template<typename R_type, CollisionPhase phase, bool non_null_nodes>
 R_type
 _chipmunk_collision_handler(
@@ -384,11 +612,101 @@ SpaceNode::set_collision_handler(
 }
 
 void
-_cp_space_query_shape_callback(
-    cpShape* cp_shape, cpContactPointSet* points, void* data)
+CollisionEventsBuffer::clear()
 {
-    auto results = reinterpret_cast<std::vector<ShapeQueryResult>*>(data);
-    results->push_back(ShapeQueryResult{cp_shape, points});
+    this->events.clear();
+    this->contact_points.clear();
+}
+
+void
+cp_record_collision_event(
+    cpArbiter* cp_arbiter, cpSpace* cp_space, const CollisionPhase phase,
+    const bool with_contact_points)
+{
+    cpBody* cp_body_a = nullptr;
+    cpBody* cp_body_b = nullptr;
+    cpShape* cp_shape_a = nullptr;
+    cpShape* cp_shape_b = nullptr;
+    cpArbiterGetBodies(cp_arbiter, &cp_body_a, &cp_body_b);
+    cpArbiterGetShapes(cp_arbiter, &cp_shape_a, &cp_shape_b);
+
+    auto handle_of = [](auto* node_part) {
+        return node_part != nullptr ? container_node(node_part)->handle()
+                                    : NodeHandle{};
+    };
+    auto space_phys = static_cast<SpaceNode*>(cpSpaceGetUserData(cp_space));
+    auto& buffer = space_phys->_collision_events;
+    CollisionEvent event{
+        phase,
+        handle_of(static_cast<BodyNode*>(cpBodyGetUserData(cp_body_a))),
+        handle_of(static_cast<HitboxNode*>(cpShapeGetUserData(cp_shape_a))),
+        handle_of(static_cast<BodyNode*>(cpBodyGetUserData(cp_body_b))),
+        handle_of(static_cast<HitboxNode*>(cpShapeGetUserData(cp_shape_b))),
+        uint32_t(buffer.contact_points.size()), 0};
+
+    // shapes are already apart when separating
+    if (with_contact_points and phase == CollisionPhase::begin) {
+        const auto cp_points = cpArbiterGetContactPointSet(cp_arbiter);
+        for (int i = 0; i < cp_points.count; i++) {
+            buffer.contact_points.push_back(CollisionContactPoint{
+                convert_vector(cp_points.points[i].pointA),
+                convert_vector(cp_points.points[i].pointB),
+                cp_points.points[i].distance});
+        }
+        event.contact_points_count = cp_points.count;
+    }
+    buffer.events.push_back(event);
+}
+
+template<bool with_contact_points>
+cpBool
+_chipmunk_collision_begin_recorder(
+    cpArbiter* cp_arbiter, cpSpace* cp_space, cpDataPointer)
+{
+    cp_record_collision_event(
+        cp_arbiter, cp_space, CollisionPhase::begin, with_contact_points);
+    return cpTrue;
+}
+
+void
+_chipmunk_collision_separate_recorder(
+    cpArbiter* cp_arbiter, cpSpace* cp_space, cpDataPointer)
+{
+    cp_record_collision_event(
+        cp_arbiter, cp_space, CollisionPhase::separate, false);
+}
+
+void
+SpaceNode::record_collision_events(
+    CollisionTriggerId trigger_a, CollisionTriggerId trigger_b,
+    const bool with_contact_points)
+{
+    cpCollisionHandler* cp_handler = cpSpaceAddCollisionHandler(
+        this->_cp_space, static_cast<cpCollisionType>(trigger_a),
+        static_cast<cpCollisionType>(trigger_b));
+
+    if (cp_handler->userData != nullptr) {
+        _release_cp_collision_handler_callback(cp_handler);
+        cp_handler->userData = nullptr;
+    }
+    cp_handler->beginFunc =
+        with_contact_points ? _chipmunk_collision_begin_recorder<true>
+                            : _chipmunk_collision_begin_recorder<false>;
+    cp_handler->preSolveFunc = _chipmunk_collision_noop<uint8_t>;
+    cp_handler->postSolveFunc = _chipmunk_collision_noop<void>;
+    cp_handler->separateFunc = _chipmunk_collision_separate_recorder;
+}
+
+const CollisionEventsBuffer&
+SpaceNode::collision_events() const
+{
+    return this->_collision_events;
+}
+
+void
+SpaceNode::clear_collision_events()
+{
+    this->_collision_events.clear();
 }
 
 void
@@ -408,29 +726,88 @@ _cp_space_query_point_callback(
     results->push_back(PointQueryResult{cp_shape, point, distance});
 }
 
-const std::vector<ShapeQueryResult>
-SpaceNode::query_shape_overlaps(
-    const Shape& shape, const CollisionBitmask mask,
-    const CollisionBitmask collision_mask, const CollisionGroup group)
+// results already in the buffer are overwritten, so their
+// contact points vectors keep allocated memory
+struct ShapeQueryBuffer {
+    std::vector<ShapeQueryResult>& results;
+    size_t count;
+};
+
+void
+_cp_space_query_shape_callback(
+    cpShape* cp_shape, cpContactPointSet* points, void* data)
 {
-    std::vector<ShapeQueryResult> results;
-    auto shape_uptr = prepare_hitbox_shape(shape, Transformation{});
-    auto filter = cpShapeGetFilter(shape_uptr.get());
+    auto buffer = static_cast<ShapeQueryBuffer*>(data);
+    if (buffer->count == buffer->results.size()) {
+        buffer->results.emplace_back(cp_shape, points);
+    } else {
+        auto& result = buffer->results[buffer->count];
+        static_cast<SpatialQueryResultBase&>(result) =
+            SpatialQueryResultBase{cp_shape};
+        result.contact_points.clear();
+        for (int i = 0; i < points->count; i++) {
+            result.contact_points.push_back(CollisionContactPoint{
+                convert_vector(points->points[i].pointA),
+                convert_vector(points->points[i].pointB),
+                points->points[i].distance});
+        }
+    }
+    buffer->count++;
+}
+
+cpShapeFilter
+make_query_filter(
+    const CollisionBitmask mask, const CollisionBitmask collision_mask,
+    const CollisionGroup group)
+{
+    cpShapeFilter filter;
     filter.categories = mask;
     filter.mask = collision_mask;
     filter.group = group;
-    cpShapeSetFilter(shape_uptr.get(), filter);
+    return filter;
+}
 
+cpShape*
+SpaceNode::_prepare_query_shape(
+    const Shape& shape, const CollisionBitmask mask,
+    const CollisionBitmask collision_mask, const CollisionGroup group)
+{
+    if (not this->_query_cp_shape or
+        not update_hitbox_shape_in_place(
+            this->_query_cp_shape.get(), shape, Transformation{})) {
+        this->_query_cp_shape = prepare_hitbox_shape(shape, Transformation{});
+    }
+    cpShape* cp_shape = this->_query_cp_shape.get();
+    cpShapeSetFilter(cp_shape, make_query_filter(mask, collision_mask, group));
     // shapes are created without BB set up, cpShapeUpdate refreshes it
-    cpShapeUpdate(shape_uptr.get(), cpTransformIdentity);
-
-    cpSpaceShapeQuery(
-        this->_cp_space, shape_uptr.get(), _cp_space_query_shape_callback,
-        &results);
+    cpShapeUpdate(cp_shape, cpTransformIdentity);
+    return cp_shape;
+}
 
+const std::vector<ShapeQueryResult>
+SpaceNode::query_shape_overlaps(
+    const Shape& shape, const CollisionBitmask mask,
+    const CollisionBitmask collision_mask, const CollisionGroup group)
+{
+    std::vector<ShapeQueryResult> results;
+    this->query_shape_overlaps(results, shape, mask, collision_mask, group);
     return results;
 }
 
+void
+SpaceNode::query_shape_overlaps(
+    std::vector<ShapeQueryResult>& results, const Shape& shape,
+    const CollisionBitmask mask, const CollisionBitmask collision_mask,
+    const CollisionGroup group)
+{
+    ShapeQueryBuffer buffer{results, 0};
+    cpSpaceShapeQuery(
+        this->_cp_space,
+        this->_prepare_query_shape(shape, mask, collision_mask, group),
+        _cp_space_query_shape_callback, &buffer);
+    results.resize(buffer.count);
+}
+
 const std::vector<RayQueryResult>
 SpaceNode::query_ray(
     const glm::dvec2 ray_start, const glm::dvec2 ray_end, const double radius,
@@ -438,17 +815,90 @@ SpaceNode::query_ray(
     const CollisionGroup group)
 {
     std::vector<RayQueryResult> results;
-    cpShapeFilter filter;
-
-    filter.categories = mask;
-    filter.mask = collision_mask;
-    filter.group = group;
+    this->query_ray(
+        results, ray_start, ray_end, radius, mask, collision_mask, group);
+    return results;
+}
 
+void
+SpaceNode::query_ray(
+    std::vector<RayQueryResult>& results, const glm::dvec2 ray_start,
+    const glm::dvec2 ray_end, const double radius,
+    const CollisionBitmask mask, const CollisionBitmask collision_mask,
+    const CollisionGroup group)
+{
+    results.clear();
     cpSpaceSegmentQuery(
         this->_cp_space, convert_vector(ray_start), convert_vector(ray_end),
-        radius, filter, _cp_space_query_raycast_callback, &results);
+        radius, make_query_filter(mask, collision_mask, group),
+        _cp_space_query_raycast_callback, &results);
+}
 
-    return results;
+std::optional<RayQueryResult>
+SpaceNode::query_ray_first(
+    const glm::dvec2 ray_start, const glm::dvec2 ray_end, const double radius,
+    const CollisionBitmask mask, const CollisionBitmask collision_mask,
+    const CollisionGroup group)
+{
+    cpSegmentQueryInfo info;
+    if (not cpSpaceSegmentQueryFirst(
+            this->_cp_space, convert_vector(ray_start),
+            convert_vector(ray_end), radius,
+            make_query_filter(mask, collision_mask, group), &info)) {
+        return std::nullopt;
+    }
+    return RayQueryResult{info.shape, info.point, info.normal, info.alpha};
+}
+
+// rays are handed to workers in chunks, single ray is too little work
+constexpr size_t rays_batch_chunk_size = 64;
+
+void
+SpaceNode::query_rays_first(
+    const std::vector<glm::dvec2>& rays_starts,
+    const std::vector<glm::dvec2>& rays_ends,
+    std::vector<std::optional<RayQueryResult>>& results, const double radius,
+    const CollisionBitmask mask, const CollisionBitmask collision_mask,
+    const CollisionGroup group, const bool use_workers)
+{
+    KAACORE_CHECK(
+        rays_starts.size() == rays_ends.size(),
+        "Rays starts and ends counts must be equal.");
+    results.resize(rays_starts.size());
+    const auto filter = make_query_filter(mask, collision_mask, group);
+    // unlike cpSpaceSegmentQuery, this doesn't lock the space
+    // and only reads its spatial indexes
+    auto query_chunk = [&](const size_t chunk) {
+        const size_t end = std::min(
+            (chunk + 1) * rays_batch_chunk_size, rays_starts.size());
+        for (size_t i = chunk * rays_batch_chunk_size; i < end; i++) {
+            cpSegmentQueryInfo info;
+            if (cpSpaceSegmentQueryFirst(
+                    this->_cp_space, convert_vector(rays_starts[i]),
+                    convert_vector(rays_ends[i]), radius, filter, &info)) {
+                results[i].emplace(
+                    info.shape, info.point, info.normal, info.alpha);
+            } else {
+                results[i].reset();
+            }
+        }
+    };
+
+    const size_t chunks_count =
+        (rays_starts.size() + rays_batch_chunk_size - 1) /
+        rays_batch_chunk_size;
+    Scene* scene = container_node(this)->_scene;
+    if (use_workers and chunks_count > 1 and scene != nullptr and
+        scene->_physics_workers) {
+        KAACORE_CHECK(
+            not this->locked(),
+            "Cannot query space concurrently while it's being simulated.");
+        scene->_physics_workers->parallel_for(chunks_count, query_chunk);
+    } else {
+        for (size_t chunk = 0; chunk < chunks_count; chunk++) {
+            query_chunk(chunk);
+        }
+    }
 }
 
 const std::vector<PointQueryResult>
@@ -458,17 +908,37 @@ SpaceNode::query_point_neighbors(
     const CollisionGroup group)
 {
     std::vector<PointQueryResult> results;
-    cpShapeFilter filter;
-
-    filter.categories = mask;
-    filter.mask = collision_mask;
-    filter.group = group;
+    this->query_point_neighbors(
+        results, point, max_distance, mask, collision_mask, group);
+    return results;
+}
 
+void
+SpaceNode::query_point_neighbors(
+    std::vector<PointQueryResult>& results, const glm::dvec2 point,
+    const double max_distance, const CollisionBitmask mask,
+    const CollisionBitmask collision_mask, const CollisionGroup group)
+{
+    results.clear();
     cpSpacePointQuery(
-        this->_cp_space, convert_vector(point), max_distance, filter,
+        this->_cp_space, convert_vector(point), max_distance,
+        make_query_filter(mask, collision_mask, group),
         _cp_space_query_point_callback, &results);
+}
 
-    return results;
+std::optional<PointQueryResult>
+SpaceNode::query_point_nearest(
+    const glm::dvec2 point, const double max_distance,
+    const CollisionBitmask mask, const CollisionBitmask collision_mask,
+    const CollisionGroup group)
+{
+    cpPointQueryInfo info;
+    if (not cpSpacePointQueryNearest(
+            this->_cp_space, convert_vector(point), max_distance,
+            make_query_filter(mask, collision_mask, group), &info)) {
+        return std::nullopt;
+    }
+    return PointQueryResult{info.shape, info.point, info.distance};
 }
 
 glm::dvec2
@@ -513,6 +983,495 @@ SpaceNode::sleeping_threshold(const double threshold)
     cpSpaceSetSleepTimeThreshold(this->_cp_space, threshold);
 }
 
+size_t
+SpaceNode::solver_threads()
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    return cpHastySpaceGetThreads(this->_cp_space);
+}
+
+void
+SpaceNode::solver_threads(const size_t threads)
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    KAACORE_CHECK(not this->locked(), "Space is locked.");
+    cpHastySpaceSetThreads(this->_cp_space, threads);
+    KAACORE_LOG_DEBUG(
+        "SpaceNode({}) uses {} solver thread(s)", fmt::ptr(this),
+        cpHastySpaceGetThreads(this->_cp_space));
+}
+
+int
+SpaceNode::iterations()
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    return cpSpaceGetIterations(this->_cp_space);
+}
+
+void
+SpaceNode::iterations(const int iterations)
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    KAACORE_CHECK(iterations > 0, "Iterations count must be positive.");
+    cpSpaceSetIterations(this->_cp_space, iterations);
+}
+
+void
+SpaceNode::clone_settings(const SpaceNode& source)
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    ASSERT_VALID_SPACE_NODE(&source);
+    cpSpace* cp_space = this->_cp_space;
+    cpSpace* source_cp_space = source._cp_space;
+
+    cpSpaceSetGravity(cp_space, cpSpaceGetGravity(source_cp_space));
+    cpSpaceSetDamping(cp_space, cpSpaceGetDamping(source_cp_space));
+    cpSpaceSetIdleSpeedThreshold(
+        cp_space, cpSpaceGetIdleSpeedThreshold(source_cp_space));
+    cpSpaceSetSleepTimeThreshold(
+        cp_space, cpSpaceGetSleepTimeThreshold(source_cp_space));
+    cpSpaceSetCollisionSlop(cp_space, cpSpaceGetCollisionSlop(source_cp_space));
+    cpSpaceSetCollisionBias(cp_space, cpSpaceGetCollisionBias(source_cp_space));
+    cpSpaceSetCollisionPersistence(
+        cp_space, cpSpaceGetCollisionPersistence(source_cp_space));
+    cpSpaceSetIterations(cp_space, cpSpaceGetIterations(source_cp_space));
+    cpHastySpaceSetThreads(cp_space, cpHastySpaceGetThreads(source_cp_space));
+
+    this->_step_size = source._step_size;
+    this->_max_steps = source._max_steps;
+    this->_interpolation = source._interpolation;
+}
+
+void
+SpaceNode::step_size(const HighPrecisionDuration step_size)
+{
+    KAACORE_CHECK(step_size > 0us, "Step size must be positive.");
+    this->_step_size = step_size;
+}
+
+HighPrecisionDuration
+SpaceNode::step_size() const
+{
+    return this->_step_size;
+}
+
+void
+SpaceNode::max_steps_per_frame(const size_t max_steps)
+{
+    KAACORE_CHECK(max_steps > 0, "Steps limit must be positive.");
+    this->_max_steps = max_steps;
+}
+
+size_t
+SpaceNode::max_steps_per_frame() const
+{
+    return this->_max_steps;
+}
+
+void
+SpaceNode::interpolation(const PhysicsInterpolation interpolation)
+{
+    this->_interpolation = interpolation;
+}
+
+PhysicsInterpolation
+SpaceNode::interpolation() const
+{
+    return this->_interpolation;
+}
+
+static_assert(
+    sizeof(SpaceSnapshot::ContactState) == sizeof(cpContact) and
+        offsetof(SpaceSnapshot::ContactState, normal_impulse) ==
+            offsetof(cpContact, jnAcc) and
+        offsetof(SpaceSnapshot::ContactState, hash) ==
+            offsetof(cpContact, hash),
+    "Snapshot contact state must match cpContact layout.");
+
+void
+_reindex_spatial_index_canonically(
+    cpSpatialIndex* cp_index, std::vector<cpShape*>& shapes_buffer)
+{
+    shapes_buffer.clear();
+    cpSpatialIndexEach(
+        cp_index,
+        [](void* obj, void* data) {
+            static_cast<std::vector<cpShape*>*>(data)->push_back(
+                static_cast<cpShape*>(obj));
+        },
+        &shapes_buffer);
+    std::sort(
+        shapes_buffer.begin(), shapes_buffer.end(),
+        [](const cpShape* a, const cpShape* b) {
+            return a->hashid < b->hashid;
+        });
+    for (cpShape* cp_shape : shapes_buffer) {
+        cpSpatialIndexRemove(cp_index, cp_shape, cp_shape->hashid);
+    }
+    for (cpShape* cp_shape : shapes_buffer) {
+        cpShapeCacheBB(cp_shape);
+        cpSpatialIndexInsert(cp_index, cp_shape, cp_shape->hashid);
+    }
+}
+
+void
+SpaceNode::_reindex_shapes_canonically(const bool include_static)
+{
+    // order of shapes in spatial indexes depends on history of insertions,
+    // it affects order in which collisions are processed
+    _reindex_spatial_index_canonically(
+        this->_cp_space->dynamicShapes, this->_reindexed_shapes);
+    // shapes of sleeping bodies are moved to static index,
+    // otherwise it is left alone, since it can be large
+    if (include_static) {
+        _reindex_spatial_index_canonically(
+            this->_cp_space->staticShapes, this->_reindexed_shapes);
+    }
+    this->_shapes_index_canonical = true;
+    this->_canonical_dynamic_shapes_count =
+        cpSpatialIndexCount(this->_cp_space->dynamicShapes);
+}
+
+bool
+SpaceNode::_is_shapes_index_canonical() const
+{
+    return this->_shapes_index_canonical and
+           this->_canonical_dynamic_shapes_count ==
+               cpSpatialIndexCount(this->_cp_space->dynamicShapes);
+}
+
+void
+SpaceNode::save_snapshot(SpaceSnapshot& snapshot)
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    KAACORE_CHECK(
+        not this->locked(), "Cannot take snapshot of space while it's locked.");
+    KAACORE_CHECK(
+        container_node(this)->_scene != nullptr,
+        "Space node must be attached to scene.");
+    // same as on restore, so continuing from this point gives
+    // the same results as restoring the snapshot
+    if (not this->_is_shapes_index_canonical()) {
+        this->_reindex_shapes_canonically(
+            this->_cp_space->sleepingComponents->num > 0);
+    }
+    cpSpace* cp_space = this->_cp_space;
+    snapshot.space = container_node(this)->handle();
+    snapshot.time_acc = this->_time_acc;
+    snapshot.steps_count = this->_steps_count;
+    snapshot.stamp = cp_space->stamp;
+    snapshot.last_step_seconds = cp_space->curr_dt;
+    snapshot.bodies.clear();
+    snapshot.arbiters.clear();
+    snapshot.contacts.clear();
+
+    auto save_body = [&snapshot](cpBody* cp_body, cpBody* cp_sleeping_root) {
+        auto body = static_cast<BodyNode*>(cpBodyGetUserData(cp_body));
+        if (body == nullptr) {
+            return;
+        }
+        auto sleeping_root =
+            cp_sleeping_root != nullptr
+                ? static_cast<BodyNode*>(cpBodyGetUserData(cp_sleeping_root))
+                : nullptr;
+        snapshot.bodies.push_back(SpaceSnapshot::BodyState{
+            container_node(body)->handle(),
+            sleeping_root != nullptr ? container_node(sleeping_root)->handle()
+                                     : NodeHandle{},
+            cp_body->p, cp_body->v, cp_body->f, cp_body->v_bias, cp_body->a,
+            cp_body->w, cp_body->t, cp_body->w_bias,
+            cp_body->sleeping.idleTime, body->_previous_position,
+            body->_previous_rotation, body->_previous_state_step});
+    };
+    auto save_arbiter = [&snapshot](
+                            cpArbiter* cp_arbiter,
+                            SpaceSnapshot::ArbiterPlacement placement) {
+        auto hitbox_a = static_cast<HitboxNode*>(cp_arbiter->a->userData);
+        auto hitbox_b = static_cast<HitboxNode*>(cp_arbiter->b->userData);
+        if (hitbox_a == nullptr or hitbox_b == nullptr) {
+            return;
+        }
+        snapshot.arbiters.push_back(SpaceSnapshot::ArbiterState{
+            container_node(hitbox_a)->handle(),
+            container_node(hitbox_b)->handle(), cp_arbiter->n,
+            cp_arbiter->surface_vr, cp_arbiter->e, cp_arbiter->u,
+            cp_arbiter->handler, cp_arbiter->handlerA, cp_arbiter->handlerB,
+            cp_arbiter->stamp, cp_arbiter->state, bool(cp_arbiter->swapped),
+            placement, uint32_t(snapshot.contacts.size()),
+            uint32_t(cp_arbiter->count)});
+        auto contacts = reinterpret_cast<SpaceSnapshot::ContactState*>(
+            cp_arbiter->contacts);
+        snapshot.contacts.insert(
+            snapshot.contacts.end(), contacts, contacts + cp_arbiter->count);
+    };
+
+    const cpArray* cp_bodies = cp_space->dynamicBodies;
+    for (int i = 0; i < cp_bodies->num; i++) {
+        save_body(static_cast<cpBody*>(cp_bodies->arr[i]), nullptr);
+    }
+    // arbiters used in the last step, their order affects solver results
+    const cpArray* cp_arbiters = cp_space->arbiters;
+    for (int i = 0; i < cp_arbiters->num; i++) {
+        save_arbiter(
+            static_cast<cpArbiter*>(cp_arbiters->arr[i]),
+            SpaceSnapshot::ArbiterPlacement::listed);
+    }
+    // sleeping bodies keep their arbiters outside of space's cache
+    const cpArray* cp_components = cp_space->sleepingComponents;
+    for (int i = 0; i < cp_components->num; i++) {
+        auto cp_root = static_cast<cpBody*>(cp_components->arr[i]);
+        for (cpBody* cp_body = cp_root; cp_body != nullptr;
+             cp_body = cp_body->sleeping.next) {
+            save_body(cp_body, cp_root);
+            CP_BODY_FOREACH_ARBITER(cp_body, cp_arbiter)
+            {
+                // arbiter is shared by both bodies, it's saved once
+                if (cp_body == cp_arbiter->body_a or
+                    cpBodyGetType(cp_arbiter->body_a) ==
+                        CP_BODY_TYPE_STATIC) {
+                    save_arbiter(
+                        cp_arbiter, SpaceSnapshot::ArbiterPlacement::sleeping);
+                }
+            }
+        }
+    }
+    cpHashSetEach(
+        cp_space->cachedArbiters,
+        [](void* elt, void* data) {
+            auto cp_arbiter = static_cast<cpArbiter*>(elt);
+            auto save_arbiter_ptr = static_cast<decltype(save_arbiter)*>(data);
+            // listed arbiters were touched in the last step and kept
+            // their contacts, others had them cleared
+            const cpSpace* cp_space = cp_arbiter->a->space;
+            if (cp_arbiter->stamp == cp_space->stamp and
+                cp_arbiter->contacts != nullptr) {
+                return;
+            }
+            (*save_arbiter_ptr)(
+                cp_arbiter, SpaceSnapshot::ArbiterPlacement::cached);
+        },
+        &save_arbiter);
+}
+
+SpaceSnapshot
+SpaceNode::save_snapshot()
+{
+    SpaceSnapshot snapshot;
+    this->save_snapshot(snapshot);
+    return snapshot;
+}
+
+void*
+_cp_snapshot_arbiter_trans(const void* ptr, void* data)
+{
+    auto cp_shapes = static_cast<cpShape* const*>(ptr);
+    auto cp_space = static_cast<cpSpace*>(data);
+    cpArbiter* cp_arbiter;
+    if (cp_space->pooledArbiters->num > 0) {
+        cp_arbiter = static_cast<cpArbiter*>(
+            cpArrayPop(cp_space->pooledArbiters));
+    } else {
+        // released together with space's other buffers
+        cp_arbiter = static_cast<cpArbiter*>(cpcalloc(1, sizeof(cpArbiter)));
+        cpArrayPush(cp_space->allocatedBuffers, cp_arbiter);
+    }
+    return cpArbiterInit(cp_arbiter, cp_shapes[0], cp_shapes[1]);
+}
+
+void
+_cp_thread_arbiter(cpArbiter* cp_arbiter, cpBody* cp_body)
+{
+    auto thread = cpArbiterThreadForBody(cp_arbiter, cp_body);
+    cpArbiter* next = cp_body->arbiterList;
+    thread->prev = nullptr;
+    thread->next = next;
+    if (next != nullptr) {
+        cpArbiterThreadForBody(next, cp_body)->prev = cp_arbiter;
+    }
+    cp_body->arbiterList = cp_arbiter;
+}
+
+void
+SpaceNode::restore_snapshot(const SpaceSnapshot& snapshot)
+{
+    ASSERT_VALID_SPACE_NODE(this);
+    Node* space_node = container_node(this);
+    KAACORE_CHECK(
+        snapshot.space == space_node->handle(),
+        "Snapshot was taken from a different space.");
+    KAACORE_CHECK(
+        not this->locked(), "Cannot restore snapshot while space is locked.");
+    Scene* scene = space_node->_scene;
+    KAACORE_CHECK(scene != nullptr, "Space node must be attached to scene.");
+    cpSpace* cp_space = this->_cp_space;
+
+    auto resolve_cp_body = [&](const NodeHandle handle) -> cpBody* {
+        Node* node = scene->node_slots.resolve(handle);
+        if (node == nullptr or node->_type != NodeType::body or
+            cpBodyGetSpace(node->body._cp_body) != cp_space) {
+            return nullptr;
+        }
+        return node->body._cp_body;
+    };
+    auto resolve_cp_shape = [&](const NodeHandle handle) -> cpShape* {
+        Node* node = scene->node_slots.resolve(handle);
+        if (node == nullptr or node->_type != NodeType::hitbox or
+            node->hitbox._cp_shape == nullptr or
+            cpShapeGetSpace(node->hitbox._cp_shape) != cp_space) {
+            return nullptr;
+        }
+        return node->hitbox._cp_shape;
+    };
+
+    // waking up everything moves all arbiters into the cache,
+    // then whole cache gets replaced
+    bool static_index_changed = cp_space->sleepingComponents->num > 0;
+    while (cp_space->sleepingComponents->num > 0) {
+        cpBodyActivate(
+            static_cast<cpBody*>(cp_space->sleepingComponents->arr[0]));
+    }
+    cpArray* cp_arbiters = cp_space->arbiters;
+    for (int i = 0; i < cp_arbiters->num; i++) {
+        cpArbiterUnthread(static_cast<cpArbiter*>(cp_arbiters->arr[i]));
+    }
+    cp_arbiters->num = 0;
+    cpHashSetFilter(
+        cp_space->cachedArbiters,
+        [](void* elt, void* data) -> cpBool {
+            auto cp_arbiter = static_cast<cpArbiter*>(elt);
+            cp_arbiter->contacts = nullptr;
+            cp_arbiter->count = 0;
+            cpArrayPush(static_cast<cpSpace*>(data)->pooledArbiters, elt);
+            return cpFalse;
+        },
+        cp_space);
+
+    for (const auto& state : snapshot.bodies) {
+        cpBody* cp_body = resolve_cp_body(state.body);
+        if (cp_body == nullptr) {
+            continue;
+        }
+        cp_body->p = state.position;
+        cp_body->v = state.velocity;
+        cp_body->f = state.force;
+        cp_body->v_bias = state.velocity_bias;
+        cp_body->w = state.angular_velocity;
+        cp_body->t = state.torque;
+        cp_body->w_bias = state.angular_velocity_bias;
+        // refreshes body transform as well
+        cpBodySetAngle(cp_body, state.angle);
+        auto body = static_cast<BodyNode*>(cpBodyGetUserData(cp_body));
+        body->_previous_position = state.previous_position;
+        body->_previous_rotation = state.previous_rotation;
+        body->_previous_state_step = state.previous_state_step;
+    }
+    this->_time_acc = snapshot.time_acc;
+    this->_steps_count = snapshot.steps_count;
+    cp_space->stamp = snapshot.stamp;
+    cp_space->curr_dt = snapshot.last_step_seconds;
+
+    this->_restored_contacts = snapshot.contacts;
+    for (const auto& state : snapshot.arbiters) {
+        cpShape* cp_shape_a = resolve_cp_shape(state.hitbox_a);
+        cpShape* cp_shape_b = resolve_cp_shape(state.hitbox_b);
+        if (cp_shape_a == nullptr or cp_shape_b == nullptr) {
+            continue;
+        }
+        const cpShape* cp_shapes[] = {cp_shape_a, cp_shape_b};
+        auto cp_arbiter = static_cast<cpArbiter*>(cpHashSetInsert(
+            cp_space->cachedArbiters,
+            CP_HASH_PAIR((cpHashValue)cp_shape_a, (cpHashValue)cp_shape_b),
+            cp_shapes, _cp_snapshot_arbiter_trans, cp_space));
+        cp_arbiter->n = state.normal;
+        cp_arbiter->surface_vr = state.surface_velocity;
+        cp_arbiter->e = state.elasticity;
+        cp_arbiter->u = state.friction;
+        cp_arbiter->handler = state.handler;
+        cp_arbiter->handlerA = state.handler_a;
+        cp_arbiter->handlerB = state.handler_b;
+        cp_arbiter->stamp = state.stamp;
+        cp_arbiter->state = static_cast<cpArbiterState>(state.state);
+        cp_arbiter->swapped = state.swapped;
+        cp_arbiter->count = state.contacts_count;
+        cp_arbiter->contacts =
+            state.contacts_count > 0
+                ? reinterpret_cast<cpContact*>(
+                      this->_restored_contacts.data() + state.contacts_offset)
+                : nullptr;
+        if (state.placement != SpaceSnapshot::ArbiterPlacement::cached) {
+            cpArrayPush(cp_arbiters, cp_arbiter);
+            _cp_thread_arbiter(cp_arbiter, cp_arbiter->body_a);
+            _cp_thread_arbiter(cp_arbiter, cp_arbiter->body_b);
+        }
+    }
+
+    // putting bodies to sleep takes their arbiters out of the cache again,
+    // components are rebuilt in the same order as they were saved
+    if (cpSpaceGetSleepTimeThreshold(cp_space) != INFINITY) {
+        for (const auto& state : snapshot.bodies) {
+            if (state.sleeping_root and state.sleeping_root == state.body) {
+                if (cpBody* cp_body = resolve_cp_body(state.body)) {
+                    cpBodySleep(cp_body);
+                }
+            }
+        }
+        for (auto it = snapshot.bodies.rbegin(); it != snapshot.bodies.rend();
+             it++) {
+            if (it->sleeping_root and it->sleeping_root != it->body) {
+                cpBody* cp_body = resolve_cp_body(it->body);
+                cpBody* cp_root = resolve_cp_body(it->sleeping_root);
+                if (cp_body != nullptr and cp_root != nullptr and
+                    cpBodyIsSleeping(cp_root)) {
+                    cpBodySleepWithGroup(cp_body, cp_root);
+                }
+            }
+        }
+    }
+
+    // order of bodies and of shapes in spatial index determine order
+    // in which solver processes them, so both are made canonical
+    cpArray* cp_bodies = cp_space->dynamicBodies;
+    int awake_bodies_count = 0;
+    for (const auto& state : snapshot.bodies) {
+        cpBody* cp_body = resolve_cp_body(state.body);
+        if (cp_body != nullptr) {
+            cp_body->sleeping.idleTime = state.idle_time;
+            if (not cpBodyIsSleeping(cp_body)) {
+                awake_bodies_count++;
+            }
+        }
+    }
+    if (awake_bodies_count == cp_bodies->num) {
+        int position = 0;
+        for (const auto& state : snapshot.bodies) {
+            cpBody* cp_body = resolve_cp_body(state.body);
+            if (cp_body != nullptr and not cpBodyIsSleeping(cp_body)) {
+                cp_bodies->arr[position++] = cp_body;
+            }
+        }
+    } else {
+        KAACORE_LOG_DEBUG(
+            "Bodies of SpaceNode({}) changed since snapshot was taken, "
+            "their order is not restored",
+            fmt::ptr(this));
+    }
+
+    static_index_changed |= cp_space->sleepingComponents->num > 0;
+    this->_reindex_shapes_canonically(static_index_changed);
+
+    bool any_moved = false;
+    for (const auto& state : snapshot.bodies) {
+        if (cpBody* cp_body = resolve_cp_body(state.body)) {
+            auto body = static_cast<BodyNode*>(cpBodyGetUserData(cp_body));
+            any_moved |= container_node(body)->_set_transformation_batched(
+                body->_simulation_position(), body->_simulation_rotation());
+        }
+    }
+    if (any_moved) {
+        Node::_commit_batched_transformations(scene);
+    }
+}
+
 bool
 SpaceNode::locked() const
 {
@@ -586,14 +1545,51 @@ BodyNode::override_simulation_position()
     ASSERT_VALID_BODY_NODE(this);
     cpBodySetPosition(
         this->_cp_body, convert_vector(container_node(this)->_position));
+    // teleported body should not be interpolated
+    this->_previous_state_step = 0;
+}
+
+SpaceNode*
+BodyNode::_interpolating_space() const
+{
+    cpSpace* cp_space = cpBodyGetSpace(this->_cp_body);
+    if (cp_space == nullptr or
+        cpBodyGetType(this->_cp_body) == CP_BODY_TYPE_STATIC or
+        cpBodyIsSleeping(this->_cp_body)) {
+        return nullptr;
+    }
+    auto space_phys = static_cast<SpaceNode*>(cpSpaceGetUserData(cp_space));
+    if (space_phys->_interpolation == PhysicsInterpolation::none or
+        (space_phys->_interpolation == PhysicsInterpolation::interpolate and
+         (this->_previous_state_step == 0 or
+          this->_previous_state_step != space_phys->_steps_count))) {
+        return nullptr;
+    }
+    return space_phys;
+}
+
+glm::dvec2
+BodyNode::_simulation_position() const
+{
+    auto position = convert_vector(cpBodyGetPosition(this->_cp_body));
+    if (auto space_phys = this->_interpolating_space()) {
+        if (space_phys->_interpolation == PhysicsInterpolation::interpolate) {
+            position = glm::mix(
+                this->_previous_position, position,
+                space_phys->_interpolation_alpha());
+        } else {
+            position += convert_vector(cpBodyGetVelocity(this->_cp_body)) *
+                        space_phys->_accumulated_seconds();
+        }
+    }
+    return position;
 }
 
 void
 BodyNode::sync_simulation_position() const
 {
     ASSERT_VALID_BODY_NODE(this);
-    container_node(this)->_set_position(
-        convert_vector(cpBodyGetPosition(this->_cp_body)));
+    container_node(this)->_set_position(this->_simulation_position());
 }
 
 void
@@ -601,13 +1597,64 @@ BodyNode::override_simulation_rotation()
 {
     ASSERT_VALID_BODY_NODE(this);
     cpBodySetAngle(this->_cp_body, container_node(this)->_rotation);
+    this->_previous_state_step = 0;
+}
+
+double
+BodyNode::_simulation_rotation() const
+{
+    double rotation = cpBodyGetAngle(this->_cp_body);
+    if (auto space_phys = this->_interpolating_space()) {
+        if (space_phys->_interpolation == PhysicsInterpolation::interpolate) {
+            rotation = glm::mix(
+                this->_previous_rotation, rotation,
+                space_phys->_interpolation_alpha());
+        } else {
+            rotation += cpBodyGetAngularVelocity(this->_cp_body) *
+                        space_phys->_accumulated_seconds();
+        }
+    }
+    return rotation;
 }
 
 void
 BodyNode::sync_simulation_rotation() const
 {
     ASSERT_VALID_BODY_NODE(this);
-    container_node(this)->_set_rotation(cpBodyGetAngle(this->_cp_body));
+    container_node(this)->_set_rotation(this->_simulation_rotation());
+}
+
+void
+BodyNode::clone_simulation_state(const BodyNode& source)
+{
+    ASSERT_VALID_BODY_NODE(this);
+    ASSERT_VALID_BODY_NODE(&source);
+    cpBody* cp_body = this->_cp_body;
+    cpBody* source_cp_body = source._cp_body;
+
+    cpBodySetType(cp_body, cpBodyGetType(source_cp_body));
+    if (cpBodyGetType(cp_body) == CP_BODY_TYPE_DYNAMIC) {
+        cpBodySetMass(cp_body, cpBodyGetMass(source_cp_body));
+        cpBodySetMoment(cp_body, cpBodyGetMoment(source_cp_body));
+    }
+    cpBodySetCenterOfGravity(
+        cp_body, cpBodyGetCenterOfGravity(source_cp_body));
+    cpBodySetPosition(cp_body, cpBodyGetPosition(source_cp_body));
+    cpBodySetAngle(cp_body, cpBodyGetAngle(source_cp_body));
+    cpBodySetVelocity(cp_body, cpBodyGetVelocity(source_cp_body));
+    cpBodySetAngularVelocity(
+        cp_body, cpBodyGetAngularVelocity(source_cp_body));
+    cpBodySetForce(cp_body, cpBodyGetForce(source_cp_body));
+    cpBodySetTorque(cp_body, cpBodyGetTorque(source_cp_body));
+
+    this->_damping = source._damping;
+    this->_gravity = source._gravity;
+    this->_velocity_update_callback = source._velocity_update_callback;
+    this->_position_update_callback = source._position_update_callback;
+    // wrappers consuming the fields above are installed the same way
+    // as on the source body
+    cpBodySetVelocityUpdateFunc(cp_body, source_cp_body->velocity_func);
+    cpBodySetPositionUpdateFunc(cp_body, source_cp_body->position_func);
 }
 
 SpaceNode*
@@ -864,6 +1911,9 @@ void
 BodyNode::sleeping(const bool sleeping)
 {
     ASSERT_VALID_BODY_NODE(this);
+    if (SpaceNode* space_phys = this->space()) {
+        space_phys->_shapes_index_canonical = false;
+    }
     if (sleeping) {
         cpBodySleep(this->_cp_body);
     } else {
@@ -995,6 +2045,49 @@ prepare_hitbox_shape(const Shape& shape, const Transformation& transformation)
     return CpShapeUniquePtr{shape_ptr, cpShapeFree};
 }
 
+bool
+update_hitbox_shape_in_place(
+    cpShape* cp_shape, const Shape& shape, const Transformation& transformation)
+{
+    const auto cp_shape_type = cp_shape->klass->type;
+    if (not((shape.type == ShapeType::segment and
+             cp_shape_type == CP_SEGMENT_SHAPE) or
+            (shape.type == ShapeType::circle and
+             cp_shape_type == CP_CIRCLE_SHAPE) or
+            (shape.type == ShapeType::polygon and
+             cp_shape_type == CP_POLY_SHAPE))) {
+        return false;
+    }
+
+    const auto transformed_shape = shape.transform(transformation);
+    const auto cp_points =
+        reinterpret_cast<const cpVect*>(transformed_shape.points.data());
+    if (shape.type == ShapeType::segment) {
+        cpSegmentShapeSetEndpoints(cp_shape, cp_points[0], cp_points[1]);
+        cpSegmentShapeSetRadius(cp_shape, transformed_shape.radius);
+    } else if (shape.type == ShapeType::circle) {
+        cpCircleShapeSetOffset(cp_shape, cp_points[0]);
+        cpCircleShapeSetRadius(cp_shape, transformed_shape.radius);
+    } else {
+        // vertices are only read, chipmunk just lacks const there
+        cpPolyShapeSetVertsRaw(
+            cp_shape, transformed_shape.points.size(),
+            const_cast<cpVect*>(cp_points));
+    }
+    return true;
+}
+
+void
+_copy_cp_shape_params(const cpShape* source, cpShape* destination)
+{
+    cpShapeSetCollisionType(destination, cpShapeGetCollisionType(source));
+    cpShapeSetFilter(destination, cpShapeGetFilter(source));
+    cpShapeSetSensor(destination, cpShapeGetSensor(source));
+    cpShapeSetElasticity(destination, cpShapeGetElasticity(source));
+    cpShapeSetFriction(destination, cpShapeGetFriction(source));
+    cpShapeSetSurfaceVelocity(destination, cpShapeGetSurfaceVelocity(source));
+}
+
 HitboxNode::HitboxNode() {}
 
 HitboxNode::~HitboxNode()
@@ -1015,20 +2108,50 @@ HitboxNode::space() const
     return nullptr;
 }
 
+Transformation
+HitboxNode::_shape_transformation() const
+{
+    const Node* node = container_node(this);
+    return Transformation() | Transformation::translate(node->_position) |
+           Transformation::rotate(node->_rotation) |
+           Transformation::scale(
+               node->_scale *
+               (node->_parent ? node->_parent->_scale : glm::dvec2(1.)));
+}
+
 void
 HitboxNode::update_physics_shape()
 {
-    Node* node = container_node(this);
-    cpShape* new_cp_shape;
+    // shape of the same kind is updated in place, which avoids
+    // reallocating it and re-adding it to the space
+    SpaceNode* space_phys = this->space();
+    if (this->_cp_shape != nullptr and
+        not(space_phys and space_phys->locked()) and
+        update_hitbox_shape_in_place(
+            this->_cp_shape, container_node(this)->_shape,
+            this->_shape_transformation())) {
+        // keeps queries accurate until the next step, it's cheap
+        // unless shape outgrows its node in the index
+        if (space_phys and cpShapeGetBody(this->_cp_shape)) {
+            cpSpaceReindexShape(space_phys->_cp_space, this->_cp_shape);
+            space_phys->_shapes_index_canonical = false;
+        }
+    } else {
+        this->recreate_physics_shape();
+    }
 
-    const auto transformation =
-        Transformation() | Transformation::translate(node->_position) |
-        Transformation::rotate(node->_rotation) |
-        Transformation::scale(
-            node->_scale *
-            (node->_parent ? node->_parent->_scale : glm::dvec2(1.)));
+    if (container_node(this)->_parent) {
+        this->attach_to_simulation();
+    }
+}
 
-    new_cp_shape = prepare_hitbox_shape(node->_shape, transformation).release();
+void
+HitboxNode::recreate_physics_shape()
+{
+    Node* node = container_node(this);
+    cpShape* new_cp_shape =
+        prepare_hitbox_shape(node->_shape, this->_shape_transformation())
+            .release();
 
     KAACORE_LOG_DEBUG(
         "Updating hitbox node {} shape (cpShape: {})", fmt::ptr(node),
@@ -1038,17 +2161,12 @@ HitboxNode::update_physics_shape()
 
     if (this->_cp_shape != nullptr) {
         cpShapeSetUserData(this->_cp_shape, nullptr);
+        if (SpaceNode* space_phys = this->space()) {
+            space_phys->_shapes_index_canonical = false;
+        }
 
         // copy over existing cpShape parameters
-        cpShapeSetCollisionType(
-            new_cp_shape, cpShapeGetCollisionType(this->_cp_shape));
-        cpShapeSetFilter(new_cp_shape, cpShapeGetFilter(this->_cp_shape));
-        cpShapeSetSensor(new_cp_shape, cpShapeGetSensor(this->_cp_shape));
-        cpShapeSetElasticity(
-            new_cp_shape, cpShapeGetElasticity(this->_cp_shape));
-        cpShapeSetFriction(new_cp_shape, cpShapeGetFriction(this->_cp_shape));
-        cpShapeSetSurfaceVelocity(
-            new_cp_shape, cpShapeGetSurfaceVelocity(this->_cp_shape));
+        _copy_cp_shape_params(this->_cp_shape, new_cp_shape);
 
         space_safe_call(
             this->space(),
@@ -1067,10 +2185,46 @@ HitboxNode::update_physics_shape()
     }
 
     this->_cp_shape = new_cp_shape;
+}
 
-    if (node->_parent) {
-        this->attach_to_simulation();
+void
+HitboxNode::clone_physics_shape(const HitboxNode& source)
+{
+    KAACORE_ASSERT(
+        this->_cp_shape == nullptr, "Hitbox has physics shape already.");
+    if (source._cp_shape == nullptr) {
+        return;
     }
+
+    // source shape is already transformed, so there is no need
+    // to go through Shape transformation again
+    const cpShape* source_cp_shape = source._cp_shape;
+    const auto shape_type = container_node(&source)->_shape.type;
+    cpShape* new_cp_shape = nullptr;
+    if (shape_type == ShapeType::segment) {
+        new_cp_shape = cpSegmentShapeNew(
+            nullptr, cpSegmentShapeGetA(source_cp_shape),
+            cpSegmentShapeGetB(source_cp_shape),
+            cpSegmentShapeGetRadius(source_cp_shape));
+    } else if (shape_type == ShapeType::circle) {
+        new_cp_shape = cpCircleShapeNew(
+            nullptr, cpCircleShapeGetRadius(source_cp_shape),
+            cpCircleShapeGetOffset(source_cp_shape));
+    } else if (shape_type == ShapeType::polygon) {
+        const int count = cpPolyShapeGetCount(source_cp_shape);
+        std::vector<cpVect> cp_points(count);
+        for (int i = 0; i < count; i++) {
+            cp_points[i] = cpPolyShapeGetVert(source_cp_shape, i);
+        }
+        new_cp_shape = cpPolyShapeNewRaw(
+            nullptr, count, cp_points.data(),
+            cpPolyShapeGetRadius(source_cp_shape));
+    }
+    KAACORE_ASSERT(new_cp_shape != nullptr, "Unsupported shape.");
+
+    _copy_cp_shape_params(source_cp_shape, new_cp_shape);
+    cpShapeSetUserData(new_cp_shape, this);
+    this->_cp_shape = new_cp_shape;
 }
 
 void
@@ -1105,6 +2259,7 @@ HitboxNode::attach_to_simulation()
             "Attaching hitbox node {} to simulation (space) (cpShape: {})",
             fmt::ptr(node), fmt::ptr(this->_cp_shape));
         ASSERT_VALID_SPACE_NODE(&node->_parent->_parent->space);
+        node->_parent->_parent->space._shapes_index_canonical = false;
         space_safe_call(
             node->_parent->_parent,
             [shape_ptr = this->_cp_shape](const SpaceNode* space_node_phys) {
@@ -1125,6 +2280,9 @@ HitboxNode::detach_from_simulation()
             "Destroying hitbox node {} (cpShape: {})",
             fmt::ptr(container_node(this)), fmt::ptr(this->_cp_shape));
         cpShapeSetUserData(this->_cp_shape, nullptr);
+        if (SpaceNode* space_phys = this->space()) {
+            space_phys->_shapes_index_canonical = false;
+        }
         space_safe_call(
             this->space(),
             [shape_ptr = this->_cp_shape](const SpaceNode* space_node_phys) {
@@ -0,0 +1,121 @@
+#include <utility>
+#include <vector>
+
+#include "kaacore/exceptions.h"
+#include "kaacore/log.h"
+#include "kaacore/nodes.h"
+#include "kaacore/physics.h"
+
+#include "kaacore/prefabs.h"
+
+namespace kaacore {
+
+Prefab
+Prefab::capture(const NodePtr node)
+{
+    KAACORE_CHECK(node, "Cannot capture uninitialized node.");
+    Prefab prefab;
+    prefab._template = _clone_subtree(node.get(), &prefab._nodes_count);
+    KAACORE_LOG_DEBUG(
+        "Captured prefab of node {} ({} nodes)", fmt::ptr(node.get()),
+        prefab._nodes_count);
+    return prefab;
+}
+
+NodeOwnerPtr
+Prefab::instantiate() const
+{
+    KAACORE_CHECK(this->_template, "Cannot instantiate empty prefab.");
+    return _clone_subtree(this->_template.get());
+}
+
+std::vector<NodeOwnerPtr>
+Prefab::instantiate(const size_t count) const
+{
+    KAACORE_CHECK(this->_template, "Cannot instantiate empty prefab.");
+    std::vector<NodeOwnerPtr> instances;
+    instances.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        instances.push_back(_clone_subtree(this->_template.get()));
+    }
+    return instances;
+}
+
+Prefab::operator bool() const
+{
+    return bool(this->_template);
+}
+
+size_t
+Prefab::nodes_count() const
+{
+    return this->_nodes_count;
+}
+
+NodeOwnerPtr
+Prefab::_clone_subtree(const Node* source_root, size_t* nodes_count)
+{
+    NodeOwnerPtr cloned_root;
+    std::vector<Node*> physics_nodes;
+    // pairs of (source node, parent of the clone), visited in pre-order
+    std::vector<std::pair<const Node*, Node*>> nodes_stack{
+        {source_root, nullptr}};
+    size_t cloned_count = 0;
+
+    while (not nodes_stack.empty()) {
+        auto [source, parent] = nodes_stack.back();
+        nodes_stack.pop_back();
+
+        Node* node = new Node(source->_type);
+        node->_position = source->_position;
+        node->_rotation = source->_rotation;
+        node->_scale = source->_scale;
+        node->_z_index = source->_z_index;
+        node->_shape = source->_shape;
+        node->_auto_shape = source->_auto_shape;
+        node->_sprite = source->_sprite;
+        node->_color = source->_color;
+        node->_visible = source->_visible;
+        node->_origin_alignment = source->_origin_alignment;
+        node->_lifetime = source->_lifetime;
+        node->_views = source->_views;
+        node->_indexable = source->_indexable;
+
+        if (source->_type == NodeType::space) {
+            node->space.clone_settings(source->space);
+        } else if (source->_type == NodeType::body) {
+            node->body.clone_simulation_state(source->body);
+            physics_nodes.push_back(node);
+        } else if (source->_type == NodeType::hitbox) {
+            node->hitbox.clone_physics_shape(source->hitbox);
+            physics_nodes.push_back(node);
+        } else if (source->_type == NodeType::text) {
+            node->text = source->text;
+        }
+
+        if (parent != nullptr) {
+            node->_parent = parent;
+            parent->_children.push_back(node);
+        } else {
+            cloned_root = NodeOwnerPtr{node};
+        }
+        node->_children.reserve(source->_children.size());
+        for (auto it = source->_children.rbegin();
+             it != source->_children.rend(); it++) {
+            nodes_stack.emplace_back(*it, node);
+        }
+        cloned_count++;
+    }
+
+    // binds cloned shapes to cloned bodies (and bodies to cloned spaces)
+    if (not physics_nodes.empty()) {
+        SpaceNode::attach_to_simulation_bulk(physics_nodes);
+    }
+
+    if (nodes_count != nullptr) {
+        *nodes_count = cloned_count;
+    }
+    return cloned_root;
+}
+
+} // namespace kaacore
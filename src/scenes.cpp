@@ -15,9 +15,12 @@
 
 namespace kaacore {
 
-Scene::Scene() : timers(this)
+Scene::Scene()
+    : timers(this), _transform_epoch(Node::_next_epoch()),
+      _ordering_epoch(Node::_next_epoch())
 {
     this->root_node._scene = this;
+    this->root_node._handle = this->node_slots.acquire(&this->root_node);
     this->spatial_index.start_tracking(&this->root_node);
 }
 
@@ -40,8 +43,82 @@ Scene::camera()
 void
 Scene::process_physics(const HighPrecisionDuration dt)
 {
-    for (Node* space_node : this->simulations_registry) {
+    // handlers and callbacks may attach or delete space nodes, registry
+    // is iterated by index and removals leave empty entries until the end
+    struct RegistryGuard {
+        Scene* scene;
+        ~RegistryGuard()
+        {
+            auto& registry = this->scene->simulations_registry;
+            registry.erase(
+                std::remove(registry.begin(), registry.end(), nullptr),
+                registry.end());
+            this->scene->_is_processing_physics = false;
+        }
+    } registry_guard{this};
+    this->_is_processing_physics = true;
+    // spaces attached during this frame are simulated from the next one
+    const size_t spaces_count = this->simulations_registry.size();
+
+    // bodies are synced right after simulation, their nodes get marked
+    // dirty in bulk with transform epoch bumped once per space, before
+    // the next space is simulated and its handlers or callbacks are called
+    if (not this->_physics_workers or spaces_count < 2) {
+        for (size_t i = 0; i < spaces_count; i++) {
+            Node* space_node = this->simulations_registry[i];
+            if (space_node == nullptr) {
+                continue;
+            }
+            space_node->space.simulate(dt);
+            if (space_node->space._sync_bodies()) {
+                Node::_commit_batched_transformations(this);
+            }
+        }
+        return;
+    }
+
+    static std::vector<Node*> concurrent_spaces;
+    static std::vector<Node*> serial_spaces;
+    concurrent_spaces.clear();
+    serial_spaces.clear();
+    for (size_t i = 0; i < spaces_count; i++) {
+        Node* space_node = this->simulations_registry[i];
+        if (space_node == nullptr) {
+            continue;
+        }
+        if (space_node->space._can_simulate_concurrently()) {
+            concurrent_spaces.push_back(space_node);
+        } else {
+            serial_spaces.push_back(space_node);
+        }
+    }
+    static std::vector<char> bodies_moved;
+    bodies_moved.assign(concurrent_spaces.size(), false);
+    this->_physics_workers->parallel_for(
+        concurrent_spaces.size(), [dt](const size_t i) {
+            concurrent_spaces[i]->space.simulate(dt);
+            bodies_moved[i] = concurrent_spaces[i]->space._sync_bodies();
+        });
+    bool any_body_moved = false;
+    for (const auto moved : bodies_moved) {
+        any_body_moved |= bool(moved);
+    }
+    if (any_body_moved) {
+        Node::_commit_batched_transformations(this);
+    }
+    for (size_t i = 0; i < serial_spaces.size(); i++) {
+        Node* space_node = serial_spaces[i];
+        // may have been deleted by previous space's handlers
+        if (std::find(
+                this->simulations_registry.begin(),
+                this->simulations_registry.end(),
+                space_node) == this->simulations_registry.end()) {
+            continue;
+        }
         space_node->space.simulate(dt);
+        if (space_node->space._sync_bodies()) {
+            Node::_commit_batched_transformations(this);
+        }
     }
 }
 
@@ -72,23 +149,22 @@ Scene::process_nodes(const HighPrecisionDuration dt)
             }
         }
 
-        if (node->_type == NodeType::body) {
-            node->body.sync_simulation_position();
-            node->body.sync_simulation_rotation();
-        }
-
         if (node->_transitions_manager) {
             node->_transitions_manager.step(node, dt);
         }
 
-        if (node->_spatial_data.is_dirty) {
-            this->spatial_index.update_single(node);
+        if (node->_is_spatial_data_outdated()) {
+            this->spatial_index.queue_update(node);
         }
 
         for (const auto child_node : node->_children) {
             processing_queue.push_back(child_node);
         }
     }
+    this->spatial_index.flush_updates();
+    if (this->spatial_index.snapshots_enabled()) {
+        this->spatial_index.publish_snapshot();
+    }
 }
 
 void
@@ -109,14 +185,15 @@ Scene::resolve_dirty_nodes()
 
         node->recalculate_model_matrix();
 
-        if (node->_spatial_data.is_dirty) {
-            this->spatial_index.update_single(node);
+        if (node->_is_spatial_data_outdated()) {
+            this->spatial_index.queue_update(node);
         }
 
         for (const auto child_node : node->_children) {
             processing_queue.push_back(child_node);
         }
     }
+    this->spatial_index.flush_updates();
 }
 
 void
@@ -197,7 +274,7 @@ Scene::on_enter()
 {}
 
 void
-Scene::update(const Duration dt)
+Scene::update(const Duration)
 {}
 
 void
@@ -217,9 +294,11 @@ Scene::register_simulation(Node* node)
     KAACORE_ASSERT(
         node->space._cp_space != nullptr,
         "Space node has invalid internal state.");
-    if (this->simulations_registry.find(node) ==
-        this->simulations_registry.end()) {
-        this->simulations_registry.insert(node);
+    if (std::find(
+            this->simulations_registry.begin(),
+            this->simulations_registry.end(),
+            node) == this->simulations_registry.end()) {
+        this->simulations_registry.push_back(node);
     }
 }
 
@@ -232,11 +311,18 @@ Scene::unregister_simulation(Node* node)
     KAACORE_ASSERT(
         node->space._cp_space != nullptr,
         "Space node has invalid internal state.");
-    auto pos = this->simulations_registry.find(node);
+    auto pos = std::find(
+        this->simulations_registry.begin(), this->simulations_registry.end(),
+        node);
     KAACORE_ASSERT(
         pos != this->simulations_registry.end(),
         "Can't unregister from simulation, space node not in registry.");
-    this->simulations_registry.erase(pos);
+    if (this->_is_processing_physics) {
+        // registry is being iterated, entry is removed afterwards
+        *pos = nullptr;
+    } else {
+        this->simulations_registry.erase(pos);
+    }
 }
 
 double
@@ -251,6 +337,37 @@ Scene::time_scale(const double scale)
     this->_time_scale = scale;
 }
 
+size_t
+Scene::physics_workers_count() const
+{
+    return this->_physics_workers ? this->_physics_workers->workers_count()
+                                  : 0;
+}
+
+void
+Scene::physics_workers_count(const size_t count)
+{
+    if (count == this->physics_workers_count()) {
+        return;
+    }
+    this->_physics_workers.reset();
+    if (count > 0) {
+        this->_physics_workers = std::make_unique<WorkerPool>(count);
+    }
+}
+
+bool
+Scene::deterministic_physics() const
+{
+    return this->_deterministic_physics;
+}
+
+void
+Scene::deterministic_physics(const bool deterministic)
+{
+    this->_deterministic_physics = deterministic;
+}
+
 const std::vector<Event>&
 Scene::get_events() const
 {
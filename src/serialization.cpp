@@ -0,0 +1,617 @@
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "kaacore/exceptions.h"
+#include "kaacore/files.h"
+#include "kaacore/fonts.h"
+#include "kaacore/images.h"
+#include "kaacore/log.h"
+#include "kaacore/nodes.h"
+#include "kaacore/physics.h"
+
+#include "kaacore/serialization.h"
+
+// serialized structures are copied to and from memory as they are
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Nodes serialization requires little-endian platform."
+#endif
+
+namespace kaacore {
+
+constexpr char serialization_magic[4] = {'K', 'A', 'A', 'N'};
+constexpr uint32_t serialization_version = 1;
+constexpr uint64_t serialized_no_parent = std::numeric_limits<uint64_t>::max();
+
+constexpr uint32_t serialized_flag_visible = 1 << 0;
+constexpr uint32_t serialized_flag_auto_shape = 1 << 1;
+constexpr uint32_t serialized_flag_indexable = 1 << 2;
+constexpr uint32_t serialized_flag_z_index = 1 << 3;
+constexpr uint32_t serialized_flag_views = 1 << 4;
+constexpr uint32_t serialized_flag_sensor = 1 << 5;
+constexpr uint32_t serialized_flag_damping = 1 << 6;
+constexpr uint32_t serialized_flag_gravity = 1 << 7;
+
+// all serialized structures have explicit padding,
+// so their layout does not depend on compiler
+struct SerializedDataRef {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct SerializedHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t nodes_count;
+    uint64_t nodes_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+struct SerializedShape {
+    uint32_t type;
+    uint32_t _padding;
+    double radius;
+    double vertices_bbox[4];
+    SerializedDataRef points;
+    SerializedDataRef indices;
+    SerializedDataRef vertices;
+    SerializedDataRef bounding_points;
+};
+
+struct SerializedNode {
+    uint64_t parent_index;
+    uint32_t type;
+    uint32_t flags;
+    int32_t z_index;
+    int32_t origin_alignment;
+    int64_t lifetime;
+    double position[2];
+    double rotation;
+    double scale[2];
+    double color[4];
+    SerializedDataRef views;
+    SerializedShape shape;
+    struct {
+        SerializedDataRef texture_path;
+        uint64_t texture_flags;
+        double origin[2];
+        double dimensions[2];
+    } sprite;
+    struct {
+        uint32_t body_type;
+        uint32_t _padding;
+        double mass;
+        double moment;
+        double center_of_gravity[2];
+        double velocity[2];
+        double angular_velocity;
+        double force[2];
+        double torque;
+        double damping;
+        double gravity[2];
+    } body;
+    struct {
+        uint64_t trigger_id;
+        uint64_t group;
+        uint32_t mask;
+        uint32_t collision_mask;
+        double elasticity;
+        double friction;
+        double surface_velocity[2];
+    } hitbox;
+    struct {
+        SerializedDataRef content;
+        SerializedDataRef font_path;
+        double font_size;
+        double line_width;
+        double interline_spacing;
+        double first_line_indent;
+    } text;
+};
+
+static_assert(std::is_trivially_copyable_v<SerializedHeader>);
+static_assert(std::is_trivially_copyable_v<SerializedNode>);
+static_assert(sizeof(SerializedHeader) % 8 == 0);
+static_assert(sizeof(SerializedNode) % 8 == 0);
+
+struct SerializedDataWriter {
+    std::vector<uint8_t> data;
+
+    template<typename T>
+    SerializedDataRef write(const T* items, const size_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        SerializedDataRef ref{0, count};
+        if (count == 0) {
+            return ref;
+        }
+        // keep arrays aligned, so they can be accessed in place
+        ref.offset = (this->data.size() + 7) & ~uint64_t(7);
+        this->data.resize(ref.offset + count * sizeof(T));
+        std::memcpy(this->data.data() + ref.offset, items, count * sizeof(T));
+        return ref;
+    }
+
+    template<typename T>
+    SerializedDataRef write(const std::vector<T>& items)
+    {
+        return this->write(items.data(), items.size());
+    }
+
+    SerializedDataRef write(const std::string& str)
+    {
+        return this->write(str.data(), str.size());
+    }
+};
+
+struct SerializedDataReader {
+    const uint8_t* data;
+    size_t size;
+
+    template<typename T>
+    const uint8_t* access(const SerializedDataRef& ref) const
+    {
+        KAACORE_THROW_IF_NOT_PASSED(
+            ref.offset <= this->size and
+                ref.count <= (this->size - ref.offset) / sizeof(T),
+            "Serialized data is corrupted (reference out of bounds).");
+        return this->data + ref.offset;
+    }
+
+    template<typename T>
+    std::vector<T> read_vector(const SerializedDataRef& ref) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto source = this->access<T>(ref);
+        std::vector<T> items(ref.count);
+        if (ref.count > 0) {
+            std::memcpy(items.data(), source, ref.count * sizeof(T));
+        }
+        return items;
+    }
+
+    std::string read_string(const SerializedDataRef& ref) const
+    {
+        auto source = this->access<char>(ref);
+        return std::string(reinterpret_cast<const char*>(source), ref.count);
+    }
+};
+
+class NodesSerializer {
+  public:
+    static std::vector<uint8_t> serialize(const Node* root);
+    static NodeOwnerPtr deserialize(const uint8_t* data, const size_t size);
+
+  private:
+    static SerializedNode _dump_node(
+        const Node* node, const uint64_t parent_index,
+        SerializedDataWriter& writer);
+    static Node* _load_node(
+        const SerializedNode& record, Node* parent,
+        const SerializedDataReader& reader, NodeOwnerPtr& root);
+
+    static SerializedShape _dump_shape(
+        const Shape& shape, SerializedDataWriter& writer);
+    static Shape _load_shape(
+        const SerializedShape& record, const SerializedDataReader& reader);
+};
+
+std::vector<uint8_t>
+NodesSerializer::serialize(const Node* root)
+{
+    std::vector<SerializedNode> records;
+    SerializedDataWriter writer;
+
+    // pairs of (node, index of parent's record), visited in pre-order
+    std::vector<std::pair<const Node*, uint64_t>> nodes_stack{
+        {root, serialized_no_parent}};
+    while (not nodes_stack.empty()) {
+        auto [node, parent_index] = nodes_stack.back();
+        nodes_stack.pop_back();
+
+        const uint64_t index = records.size();
+        records.push_back(_dump_node(node, parent_index, writer));
+        for (auto it = node->_children.rbegin(); it != node->_children.rend();
+             it++) {
+            nodes_stack.emplace_back(*it, index);
+        }
+    }
+
+    SerializedHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, serialization_magic, sizeof(header.magic));
+    header.version = serialization_version;
+    header.nodes_count = records.size();
+    header.nodes_offset = sizeof(SerializedHeader);
+    header.data_offset =
+        header.nodes_offset + records.size() * sizeof(SerializedNode);
+    header.data_size = writer.data.size();
+
+    std::vector<uint8_t> output(header.data_offset + header.data_size);
+    std::memcpy(output.data(), &header, sizeof(header));
+    std::memcpy(
+        output.data() + header.nodes_offset, records.data(),
+        records.size() * sizeof(SerializedNode));
+    if (header.data_size > 0) {
+        std::memcpy(
+            output.data() + header.data_offset, writer.data.data(),
+            header.data_size);
+    }
+    return output;
+}
+
+NodeOwnerPtr
+NodesSerializer::deserialize(const uint8_t* data, const size_t size)
+{
+    KAACORE_THROW_IF_NOT_PASSED(
+        data != nullptr and size >= sizeof(SerializedHeader),
+        "Serialized data is too short.");
+    SerializedHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    KAACORE_THROW_IF_NOT_PASSED(
+        std::memcmp(header.magic, serialization_magic, sizeof(header.magic)) ==
+            0,
+        "Invalid serialized data header.");
+    KAACORE_THROW_IF_NOT_PASSED(
+        header.version == serialization_version,
+        "Unsupported serialized data version: {}.", header.version);
+    KAACORE_THROW_IF_NOT_PASSED(
+        header.nodes_count > 0, "Serialized data has no nodes.");
+    KAACORE_THROW_IF_NOT_PASSED(
+        header.nodes_offset <= size and
+            header.nodes_count <=
+                (size - header.nodes_offset) / sizeof(SerializedNode) and
+            header.data_offset >=
+                header.nodes_offset +
+                    header.nodes_count * sizeof(SerializedNode) and
+            header.data_offset <= size and
+            header.data_size <= size - header.data_offset,
+        "Serialized data is corrupted (invalid sections).");
+
+    const SerializedDataReader reader{data + header.data_offset,
+                                      header.data_size};
+    NodeOwnerPtr root;
+    std::vector<Node*> loaded_nodes;
+    std::vector<Node*> physics_nodes;
+    loaded_nodes.reserve(header.nodes_count);
+
+    for (uint64_t i = 0; i < header.nodes_count; i++) {
+        SerializedNode record;
+        std::memcpy(
+            &record, data + header.nodes_offset + i * sizeof(SerializedNode),
+            sizeof(SerializedNode));
+
+        Node* parent = nullptr;
+        if (i == 0) {
+            KAACORE_THROW_IF_NOT_PASSED(
+                record.parent_index == serialized_no_parent,
+                "Serialized data is corrupted (invalid root node).");
+        } else {
+            // records are stored in pre-order, so parent is already loaded
+            KAACORE_THROW_IF_NOT_PASSED(
+                record.parent_index < i,
+                "Serialized data is corrupted (invalid parent index).");
+            parent = loaded_nodes[record.parent_index];
+        }
+
+        Node* node = _load_node(record, parent, reader, root);
+        loaded_nodes.push_back(node);
+        if (node->_type == NodeType::body or node->_type == NodeType::hitbox) {
+            physics_nodes.push_back(node);
+        }
+    }
+
+    if (not physics_nodes.empty()) {
+        SpaceNode::attach_to_simulation_bulk(physics_nodes);
+    }
+    KAACORE_LOG_DEBUG(
+        "Deserialized {} nodes ({} bytes)", header.nodes_count, size);
+    return root;
+}
+
+SerializedNode
+NodesSerializer::_dump_node(
+    const Node* node, const uint64_t parent_index, SerializedDataWriter& writer)
+{
+    SerializedNode record;
+    std::memset(&record, 0, sizeof(record));
+    record.parent_index = parent_index;
+    record.type = static_cast<uint32_t>(node->_type);
+    record.position[0] = node->_position.x;
+    record.position[1] = node->_position.y;
+    record.rotation = node->_rotation;
+    record.scale[0] = node->_scale.x;
+    record.scale[1] = node->_scale.y;
+    for (int i = 0; i < 4; i++) {
+        record.color[i] = node->_color[i];
+    }
+    record.origin_alignment = static_cast<int32_t>(node->_origin_alignment);
+    record.lifetime = node->_lifetime.count();
+
+    if (node->_visible) {
+        record.flags |= serialized_flag_visible;
+    }
+    if (node->_auto_shape) {
+        record.flags |= serialized_flag_auto_shape;
+    }
+    if (node->_indexable) {
+        record.flags |= serialized_flag_indexable;
+    }
+    if (node->_z_index.has_value()) {
+        record.flags |= serialized_flag_z_index;
+        record.z_index = node->_z_index.value();
+    }
+    if (node->_views.has_value()) {
+        record.flags |= serialized_flag_views;
+        std::vector<int16_t> z_indices = node->_views.value();
+        record.views = writer.write(z_indices);
+    }
+
+    record.shape = _dump_shape(node->_shape, writer);
+
+    // text nodes get their sprite from font
+    if (node->_sprite and node->_type != NodeType::text) {
+        const auto& image = node->_sprite.texture.res_ptr;
+        if (image->path.empty()) {
+            KAACORE_LOG_WARN(
+                "Sprite of node {} has no source path, it won't be "
+                "serialized.",
+                fmt::ptr(node));
+        } else {
+            record.sprite.texture_path = writer.write(image->path);
+            record.sprite.texture_flags = image->flags;
+        }
+    }
+    record.sprite.origin[0] = node->_sprite.origin.x;
+    record.sprite.origin[1] = node->_sprite.origin.y;
+    record.sprite.dimensions[0] = node->_sprite.dimensions.x;
+    record.sprite.dimensions[1] = node->_sprite.dimensions.y;
+
+    if (node->_type == NodeType::body) {
+        cpBody* cp_body = node->body._cp_body;
+        record.body.body_type = cpBodyGetType(cp_body);
+        record.body.mass = cpBodyGetMass(cp_body);
+        record.body.moment = cpBodyGetMoment(cp_body);
+        const auto cog = cpBodyGetCenterOfGravity(cp_body);
+        record.body.center_of_gravity[0] = cog.x;
+        record.body.center_of_gravity[1] = cog.y;
+        const auto velocity = cpBodyGetVelocity(cp_body);
+        record.body.velocity[0] = velocity.x;
+        record.body.velocity[1] = velocity.y;
+        record.body.angular_velocity = cpBodyGetAngularVelocity(cp_body);
+        const auto force = cpBodyGetForce(cp_body);
+        record.body.force[0] = force.x;
+        record.body.force[1] = force.y;
+        record.body.torque = cpBodyGetTorque(cp_body);
+        if (node->body._damping.has_value()) {
+            record.flags |= serialized_flag_damping;
+            record.body.damping = node->body._damping.value();
+        }
+        if (node->body._gravity.has_value()) {
+            record.flags |= serialized_flag_gravity;
+            record.body.gravity[0] = node->body._gravity->x;
+            record.body.gravity[1] = node->body._gravity->y;
+        }
+    } else if (node->_type == NodeType::hitbox and node->hitbox._cp_shape) {
+        const cpShape* cp_shape = node->hitbox._cp_shape;
+        const auto filter = cpShapeGetFilter(cp_shape);
+        record.hitbox.trigger_id = cpShapeGetCollisionType(cp_shape);
+        record.hitbox.group = filter.group;
+        record.hitbox.mask = filter.categories;
+        record.hitbox.collision_mask = filter.mask;
+        if (cpShapeGetSensor(cp_shape)) {
+            record.flags |= serialized_flag_sensor;
+        }
+        record.hitbox.elasticity = cpShapeGetElasticity(cp_shape);
+        record.hitbox.friction = cpShapeGetFriction(cp_shape);
+        const auto surface_velocity = cpShapeGetSurfaceVelocity(cp_shape);
+        record.hitbox.surface_velocity[0] = surface_velocity.x;
+        record.hitbox.surface_velocity[1] = surface_velocity.y;
+    } else if (node->_type == NodeType::text) {
+        const TextNode& text = node->text;
+        record.text.content = writer.write(text._content);
+        // default font is embedded, so it has no path
+        record.text.font_path = writer.write(text._font._font_data->path);
+        record.text.font_size = text._font_size;
+        record.text.line_width = text._line_width;
+        record.text.interline_spacing = text._interline_spacing;
+        record.text.first_line_indent = text._first_line_indent;
+    }
+
+    return record;
+}
+
+Node*
+NodesSerializer::_load_node(
+    const SerializedNode& record, Node* parent,
+    const SerializedDataReader& reader, NodeOwnerPtr& root)
+{
+    KAACORE_THROW_IF_NOT_PASSED(
+        record.type >= static_cast<uint32_t>(NodeType::basic) and
+            record.type <= static_cast<uint32_t>(NodeType::text),
+        "Serialized data is corrupted (invalid node type).");
+    // node is owned by the loaded tree right away,
+    // so it's not leaked if loading fails halfway
+    Node* node = new Node(static_cast<NodeType>(record.type));
+    if (parent != nullptr) {
+        node->_parent = parent;
+        parent->_children.push_back(node);
+    } else {
+        root = NodeOwnerPtr{node};
+    }
+
+    node->_position = {record.position[0], record.position[1]};
+    node->_rotation = record.rotation;
+    node->_scale = {record.scale[0], record.scale[1]};
+    node->_color = {record.color[0], record.color[1], record.color[2],
+                    record.color[3]};
+    node->_origin_alignment = static_cast<Alignment>(record.origin_alignment);
+    node->_lifetime = HighPrecisionDuration(record.lifetime);
+    node->_visible = record.flags & serialized_flag_visible;
+    node->_auto_shape = record.flags & serialized_flag_auto_shape;
+    node->_indexable = record.flags & serialized_flag_indexable;
+    if (record.flags & serialized_flag_z_index) {
+        node->_z_index = record.z_index;
+    }
+    if (record.flags & serialized_flag_views) {
+        const auto z_indices = reader.read_vector<int16_t>(record.views);
+        node->_views = ViewIndexSet{
+            std::unordered_set<int16_t>{z_indices.begin(), z_indices.end()}};
+    }
+
+    node->_shape = _load_shape(record.shape, reader);
+
+    if (record.sprite.texture_path.count > 0) {
+        node->_sprite = Sprite::load(
+            reader.read_string(record.sprite.texture_path).c_str(),
+            record.sprite.texture_flags);
+        node->_sprite.origin = {record.sprite.origin[0],
+                                record.sprite.origin[1]};
+        node->_sprite.dimensions = {record.sprite.dimensions[0],
+                                    record.sprite.dimensions[1]};
+    }
+
+    if (node->_type == NodeType::body) {
+        cpBody* cp_body = node->body._cp_body;
+        cpBodySetType(cp_body, static_cast<cpBodyType>(record.body.body_type));
+        if (cpBodyGetType(cp_body) == CP_BODY_TYPE_DYNAMIC) {
+            cpBodySetMass(cp_body, record.body.mass);
+            cpBodySetMoment(cp_body, record.body.moment);
+        }
+        cpBodySetCenterOfGravity(
+            cp_body, cpv(record.body.center_of_gravity[0],
+                         record.body.center_of_gravity[1]));
+        cpBodySetPosition(cp_body, cpv(record.position[0], record.position[1]));
+        cpBodySetAngle(cp_body, record.rotation);
+        cpBodySetVelocity(
+            cp_body, cpv(record.body.velocity[0], record.body.velocity[1]));
+        cpBodySetAngularVelocity(cp_body, record.body.angular_velocity);
+        cpBodySetForce(
+            cp_body, cpv(record.body.force[0], record.body.force[1]));
+        cpBodySetTorque(cp_body, record.body.torque);
+        // setters install velocity update wrapper using these overrides
+        if (record.flags & serialized_flag_damping) {
+            node->body.damping(record.body.damping);
+        }
+        if (record.flags & serialized_flag_gravity) {
+            node->body.gravity(
+                glm::dvec2{record.body.gravity[0], record.body.gravity[1]});
+        }
+    } else if (node->_type == NodeType::hitbox and node->_shape) {
+        // shape depends on parent's scale, which is already loaded
+        node->hitbox.recreate_physics_shape();
+        cpShape* cp_shape = node->hitbox._cp_shape;
+        cpShapeSetCollisionType(cp_shape, record.hitbox.trigger_id);
+        cpShapeSetFilter(
+            cp_shape,
+            cpShapeFilterNew(
+                record.hitbox.group, record.hitbox.mask,
+                record.hitbox.collision_mask));
+        cpShapeSetSensor(cp_shape, record.flags & serialized_flag_sensor);
+        cpShapeSetElasticity(cp_shape, record.hitbox.elasticity);
+        cpShapeSetFriction(cp_shape, record.hitbox.friction);
+        cpShapeSetSurfaceVelocity(
+            cp_shape, cpv(record.hitbox.surface_velocity[0],
+                          record.hitbox.surface_velocity[1]));
+    } else if (node->_type == NodeType::text) {
+        TextNode& text = node->text;
+        text._content = reader.read_string(record.text.content);
+        const auto font_path = reader.read_string(record.text.font_path);
+        text._font = font_path.empty() ? get_default_font()
+                                       : Font::load(font_path);
+        text._font_size = record.text.font_size;
+        text._line_width = record.text.line_width;
+        text._interline_spacing = record.text.interline_spacing;
+        text._first_line_indent = record.text.first_line_indent;
+        // glyphs shape was loaded already, only texture is missing
+        node->_sprite = Sprite(text._font._font_data->baked_texture);
+    }
+
+    return node;
+}
+
+SerializedShape
+NodesSerializer::_dump_shape(const Shape& shape, SerializedDataWriter& writer)
+{
+    SerializedShape record;
+    std::memset(&record, 0, sizeof(record));
+    record.type = static_cast<uint32_t>(shape.type);
+    if (not shape) {
+        return record;
+    }
+    record.radius = shape.radius;
+    record.vertices_bbox[0] = shape.vertices_bbox.min_x;
+    record.vertices_bbox[1] = shape.vertices_bbox.min_y;
+    record.vertices_bbox[2] = shape.vertices_bbox.max_x;
+    record.vertices_bbox[3] = shape.vertices_bbox.max_y;
+    record.points = writer.write(shape.points);
+    record.indices = writer.write(shape.indices);
+    record.vertices = writer.write(shape.vertices);
+    record.bounding_points = writer.write(shape.bounding_points);
+    return record;
+}
+
+Shape
+NodesSerializer::_load_shape(
+    const SerializedShape& record, const SerializedDataReader& reader)
+{
+    KAACORE_THROW_IF_NOT_PASSED(
+        record.type <= static_cast<uint32_t>(ShapeType::freeform),
+        "Serialized data is corrupted (invalid shape type).");
+    Shape shape;
+    shape.type = static_cast<ShapeType>(record.type);
+    if (not shape) {
+        return shape;
+    }
+    // shape was validated when it was created, so it's
+    // restored directly instead of going through constructor
+    shape.radius = record.radius;
+    shape.vertices_bbox = {record.vertices_bbox[0], record.vertices_bbox[1],
+                           record.vertices_bbox[2], record.vertices_bbox[3]};
+    shape.points = reader.read_vector<glm::dvec2>(record.points);
+    shape.indices = reader.read_vector<VertexIndex>(record.indices);
+    shape.vertices = reader.read_vector<StandardVertexData>(record.vertices);
+    shape.bounding_points =
+        reader.read_vector<glm::dvec2>(record.bounding_points);
+    return shape;
+}
+
+std::vector<uint8_t>
+serialize_nodes(const NodePtr root)
+{
+    KAACORE_CHECK(root, "Cannot serialize uninitialized node.");
+    return NodesSerializer::serialize(root.get());
+}
+
+NodeOwnerPtr
+deserialize_nodes(const uint8_t* data, const size_t size)
+{
+    return NodesSerializer::deserialize(data, size);
+}
+
+void
+save_nodes(const NodePtr root, const std::string& path)
+{
+    const auto data = serialize_nodes(root);
+    KAACORE_LOG_INFO("Writing file: {}", path);
+    std::ofstream f(path, std::ofstream::binary);
+    if (f.fail()) {
+        throw exception("Failed to open file: " + path);
+    }
+    f.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+NodeOwnerPtr
+load_nodes(const std::string& path)
+{
+    RawFile file(path);
+    return deserialize_nodes(file.content.data(), file.content.size());
+}
+
+} // namespace kaacore
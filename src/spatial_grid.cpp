@@ -0,0 +1,546 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <optional>
+#include <vector>
+
+#include "kaacore/exceptions.h"
+#include "kaacore/log.h"
+#include "kaacore/utils.h"
+
+#include "kaacore/spatial_grid.h"
+
+namespace kaacore {
+
+// objects spanning more cells than that are not bucketed,
+// every query checks them directly instead
+constexpr int64_t uniform_grid_max_object_cells = 64;
+
+struct UniformGridEntry {
+    void* obj;
+    cpHashValue hashid;
+    cpBB bb;
+    uint64_t query_stamp;
+};
+
+struct UniformGridCellsRange {
+    int64_t min_x;
+    int64_t min_y;
+    int64_t max_x;
+    int64_t max_y;
+
+    inline bool operator==(const UniformGridCellsRange& other) const
+    {
+        return this->min_x == other.min_x and this->min_y == other.min_y and
+               this->max_x == other.max_x and this->max_y == other.max_y;
+    }
+
+    inline bool operator!=(const UniformGridCellsRange& other) const
+    {
+        return not(*this == other);
+    }
+
+    inline int64_t cells_count() const
+    {
+        return (this->max_x - this->min_x + 1) *
+               (this->max_y - this->min_y + 1);
+    }
+};
+
+// Maps hashids to positions of entries, open addressing with linear
+// probing keeps inserts and removals free of allocations (apart from
+// occasional growth).
+struct UniformGridPositionsTable {
+    static constexpr uint32_t empty_position =
+        std::numeric_limits<uint32_t>::max();
+
+    struct Slot {
+        cpHashValue hashid;
+        uint32_t position = empty_position;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    size_t home_of(const cpHashValue hashid) const;
+    size_t slot_of(const cpHashValue hashid) const;
+    uint32_t* find(const cpHashValue hashid);
+    void insert(const cpHashValue hashid, const uint32_t position);
+    void erase(const cpHashValue hashid);
+    void grow();
+};
+
+size_t
+UniformGridPositionsTable::home_of(const cpHashValue hashid) const
+{
+    // hashids are often sequential, so they are mixed before masking
+    return (uint64_t(hashid) * 0x9E3779B97F4A7C15ull >> 32) &
+           (this->slots.size() - 1);
+}
+
+size_t
+UniformGridPositionsTable::slot_of(const cpHashValue hashid) const
+{
+    const size_t mask = this->slots.size() - 1;
+    size_t i = this->home_of(hashid);
+    while (this->slots[i].position != empty_position and
+           this->slots[i].hashid != hashid) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+uint32_t*
+UniformGridPositionsTable::find(const cpHashValue hashid)
+{
+    if (this->slots.empty()) {
+        return nullptr;
+    }
+    auto& slot = this->slots[this->slot_of(hashid)];
+    return slot.position != empty_position ? &slot.position : nullptr;
+}
+
+void
+UniformGridPositionsTable::insert(
+    const cpHashValue hashid, const uint32_t position)
+{
+    // load factor is kept at most 1/2, so probe sequences stay short
+    if ((this->count + 1) * 2 > this->slots.size()) {
+        this->grow();
+    }
+    auto& slot = this->slots[this->slot_of(hashid)];
+    if (slot.position == empty_position) {
+        this->count++;
+    }
+    slot.hashid = hashid;
+    slot.position = position;
+}
+
+void
+UniformGridPositionsTable::erase(const cpHashValue hashid)
+{
+    if (this->slots.empty()) {
+        return;
+    }
+    const size_t mask = this->slots.size() - 1;
+    size_t hole = this->slot_of(hashid);
+    if (this->slots[hole].position == empty_position) {
+        return;
+    }
+    this->count--;
+    // shift following slots of the probe sequence back,
+    // so lookups never need tombstones
+    for (size_t i = (hole + 1) & mask;
+         this->slots[i].position != empty_position; i = (i + 1) & mask) {
+        const size_t home = this->home_of(this->slots[i].hashid);
+        const bool stays = hole <= i ? (hole < home and home <= i)
+                                     : (hole < home or home <= i);
+        if (not stays) {
+            this->slots[hole] = this->slots[i];
+            hole = i;
+        }
+    }
+    this->slots[hole].position = empty_position;
+}
+
+void
+UniformGridPositionsTable::grow()
+{
+    std::vector<Slot> old_slots(std::max<size_t>(this->slots.size() * 2, 16));
+    old_slots.swap(this->slots);
+    this->count = 0;
+    for (const auto& slot : old_slots) {
+        if (slot.position != empty_position) {
+            this->insert(slot.hashid, slot.position);
+        }
+    }
+}
+
+struct UniformGridIndex {
+    cpSpatialIndex spatial_index;
+    double cell_size;
+    size_t buckets_mask;
+    std::vector<UniformGridEntry> entries;
+    UniformGridPositionsTable entries_positions;
+    // buckets are stored in CSR layout: entries of bucket `i` are
+    // located in buckets_entries[buckets_offsets[i]:buckets_offsets[i+1]]
+    std::vector<uint32_t> buckets_offsets;
+    std::vector<uint32_t> buckets_entries;
+    std::vector<uint32_t> oversized_entries;
+    bool is_dirty = true;
+    uint64_t query_stamp = 0;
+
+    std::optional<UniformGridCellsRange> cells_range(const cpBB& bb) const;
+    size_t bucket_of(const int64_t x, const int64_t y) const;
+    bool update_entry(UniformGridEntry& entry);
+    void rebuild();
+
+    template<typename Func>
+    void query(const cpBB& bb, Func&& func);
+    template<typename Func>
+    void segment_query(
+        const cpVect a, const cpVect b, cpFloat t_exit, Func&& func);
+};
+
+std::optional<UniformGridCellsRange>
+UniformGridIndex::cells_range(const cpBB& bb) const
+{
+    const double min_x = std::floor(bb.l / this->cell_size);
+    const double min_y = std::floor(bb.b / this->cell_size);
+    const double max_x = std::floor(bb.r / this->cell_size);
+    const double max_y = std::floor(bb.t / this->cell_size);
+    // also rejects NaN and infinite boxes
+    if (not(max_x - min_x < uniform_grid_max_object_cells and
+            max_y - min_y < uniform_grid_max_object_cells and
+            std::abs(min_x) < 1e15 and std::abs(min_y) < 1e15)) {
+        return std::nullopt;
+    }
+    UniformGridCellsRange range{int64_t(min_x), int64_t(min_y),
+                                int64_t(max_x), int64_t(max_y)};
+    if (range.cells_count() > uniform_grid_max_object_cells) {
+        return std::nullopt;
+    }
+    return range;
+}
+
+size_t
+UniformGridIndex::bucket_of(const int64_t x, const int64_t y) const
+{
+    return ((uint64_t(x) * 73856093u) ^ (uint64_t(y) * 19349663u)) &
+           this->buckets_mask;
+}
+
+bool
+UniformGridIndex::update_entry(UniformGridEntry& entry)
+{
+    const cpBB bb = this->spatial_index.bbfunc(entry.obj);
+    // buckets need no rebuild when object stays within the same cells
+    const bool cells_changed =
+        this->cells_range(bb) != this->cells_range(entry.bb);
+    entry.bb = bb;
+    return cells_changed;
+}
+
+void
+UniformGridIndex::rebuild()
+{
+    this->buckets_offsets.assign(this->buckets_mask + 2, 0);
+    this->oversized_entries.clear();
+
+    // count entries per bucket first, so they can be placed
+    // in a single contiguous array (counting sort)
+    for (uint32_t i = 0; i < this->entries.size(); i++) {
+        const auto range = this->cells_range(this->entries[i].bb);
+        if (not range) {
+            this->oversized_entries.push_back(i);
+            continue;
+        }
+        for (int64_t y = range->min_y; y <= range->max_y; y++) {
+            for (int64_t x = range->min_x; x <= range->max_x; x++) {
+                this->buckets_offsets[this->bucket_of(x, y) + 1]++;
+            }
+        }
+    }
+    for (size_t i = 1; i < this->buckets_offsets.size(); i++) {
+        this->buckets_offsets[i] += this->buckets_offsets[i - 1];
+    }
+
+    this->buckets_entries.resize(this->buckets_offsets.back());
+    std::vector<uint32_t> cursors(
+        this->buckets_offsets.begin(), this->buckets_offsets.end() - 1);
+    for (uint32_t i = 0; i < this->entries.size(); i++) {
+        const auto range = this->cells_range(this->entries[i].bb);
+        if (not range) {
+            continue;
+        }
+        for (int64_t y = range->min_y; y <= range->max_y; y++) {
+            for (int64_t x = range->min_x; x <= range->max_x; x++) {
+                this->buckets_entries[cursors[this->bucket_of(x, y)]++] = i;
+            }
+        }
+    }
+    this->is_dirty = false;
+}
+
+template<typename Func>
+void
+UniformGridIndex::query(const cpBB& bb, Func&& func)
+{
+    if (this->is_dirty) {
+        this->rebuild();
+    }
+    // entries can be reached through multiple cells,
+    // stamp makes sure every one is reported once
+    const uint64_t stamp = ++this->query_stamp;
+    auto visit = [&](UniformGridEntry& entry) {
+        if (entry.query_stamp != stamp) {
+            entry.query_stamp = stamp;
+            if (cpBBIntersects(entry.bb, bb)) {
+                func(entry);
+            }
+        }
+    };
+
+    const auto range = this->cells_range(bb);
+    if (not range or
+        size_t(range->cells_count()) > this->buckets_mask + 1) {
+        // large queries visit every bucket anyway
+        for (auto& entry : this->entries) {
+            visit(entry);
+        }
+        return;
+    }
+
+    for (int64_t y = range->min_y; y <= range->max_y; y++) {
+        for (int64_t x = range->min_x; x <= range->max_x; x++) {
+            const size_t bucket = this->bucket_of(x, y);
+            for (uint32_t i = this->buckets_offsets[bucket];
+                 i < this->buckets_offsets[bucket + 1]; i++) {
+                visit(this->entries[this->buckets_entries[i]]);
+            }
+        }
+    }
+    for (auto i : this->oversized_entries) {
+        visit(this->entries[i]);
+    }
+}
+
+template<typename Func>
+void
+UniformGridIndex::segment_query(
+    const cpVect a, const cpVect b, cpFloat t_exit, Func&& func)
+{
+    if (this->is_dirty) {
+        this->rebuild();
+    }
+    const uint64_t stamp = ++this->query_stamp;
+    // func returns fraction of the segment at which it was hit,
+    // entries entirely behind the closest hit can be skipped
+    auto visit = [&](UniformGridEntry& entry) {
+        if (entry.query_stamp != stamp) {
+            entry.query_stamp = stamp;
+            if (cpBBSegmentQuery(entry.bb, a, b) < t_exit) {
+                t_exit = std::min(t_exit, func(entry));
+            }
+        }
+    };
+
+    for (auto i : this->oversized_entries) {
+        visit(this->entries[i]);
+    }
+
+    // walk the cells crossed by segment in order (DDA), unless segment
+    // crosses more cells than there are entries
+    const cpVect cell_a = cpvmult(a, 1. / this->cell_size);
+    const cpVect cell_b = cpvmult(b, 1. / this->cell_size);
+    const double dx = std::abs(cell_b.x - cell_a.x);
+    const double dy = std::abs(cell_b.y - cell_a.y);
+    const double crossed_cells = std::floor(dx) + std::floor(dy) + 2.;
+    if (not(crossed_cells <= this->entries.size() and
+            std::abs(cell_a.x) < 1e15 and std::abs(cell_a.y) < 1e15)) {
+        for (auto& entry : this->entries) {
+            visit(entry);
+        }
+        return;
+    }
+
+    int64_t x = int64_t(std::floor(cell_a.x));
+    int64_t y = int64_t(std::floor(cell_a.y));
+    const int64_t x_inc = cell_b.x > cell_a.x ? 1 : -1;
+    const int64_t y_inc = cell_b.y > cell_a.y ? 1 : -1;
+    // segment fractions needed to cross one cell in each axis, and to
+    // reach the next cell boundary
+    const double dt_dx = 1. / dx;
+    const double dt_dy = 1. / dy;
+    const double to_boundary_x = cell_b.x > cell_a.x
+                                     ? std::floor(cell_a.x) + 1. - cell_a.x
+                                     : cell_a.x - std::floor(cell_a.x);
+    const double to_boundary_y = cell_b.y > cell_a.y
+                                     ? std::floor(cell_a.y) + 1. - cell_a.y
+                                     : cell_a.y - std::floor(cell_a.y);
+    double next_x = to_boundary_x > 0. ? to_boundary_x * dt_dx : dt_dx;
+    double next_y = to_boundary_y > 0. ? to_boundary_y * dt_dy : dt_dy;
+
+    // cells past the segment's end are not visited either
+    double t = 0.;
+    while (t < t_exit and t <= 1.) {
+        const size_t bucket = this->bucket_of(x, y);
+        for (uint32_t i = this->buckets_offsets[bucket];
+             i < this->buckets_offsets[bucket + 1]; i++) {
+            visit(this->entries[this->buckets_entries[i]]);
+        }
+        if (next_y < next_x) {
+            y += y_inc;
+            t = next_y;
+            next_y += dt_dy;
+        } else {
+            x += x_inc;
+            t = next_x;
+            next_x += dt_dx;
+        }
+    }
+}
+
+inline UniformGridIndex*
+get_grid(cpSpatialIndex* index)
+{
+    return container_of(index, &UniformGridIndex::spatial_index);
+}
+
+void
+_uniform_grid_destroy(cpSpatialIndex* index)
+{
+    // memory itself is released by cpSpatialIndexFree
+    get_grid(index)->~UniformGridIndex();
+}
+
+int
+_uniform_grid_count(cpSpatialIndex* index)
+{
+    return get_grid(index)->entries.size();
+}
+
+void
+_uniform_grid_each(
+    cpSpatialIndex* index, cpSpatialIndexIteratorFunc func, void* data)
+{
+    for (const auto& entry : get_grid(index)->entries) {
+        func(entry.obj, data);
+    }
+}
+
+cpBool
+_uniform_grid_contains(cpSpatialIndex* index, void* obj, cpHashValue hashid)
+{
+    auto grid = get_grid(index);
+    auto position = grid->entries_positions.find(hashid);
+    return position != nullptr and grid->entries[*position].obj == obj;
+}
+
+void
+_uniform_grid_insert(cpSpatialIndex* index, void* obj, cpHashValue hashid)
+{
+    auto grid = get_grid(index);
+    KAACORE_ASSERT(
+        grid->entries_positions.find(hashid) == nullptr,
+        "Object is already in the index.");
+    grid->entries_positions.insert(hashid, grid->entries.size());
+    grid->entries.push_back({obj, hashid, index->bbfunc(obj), 0});
+    grid->is_dirty = true;
+}
+
+void
+_uniform_grid_remove(cpSpatialIndex* index, void*, cpHashValue hashid)
+{
+    auto grid = get_grid(index);
+    auto found_position = grid->entries_positions.find(hashid);
+    if (found_position == nullptr) {
+        return;
+    }
+    const uint32_t position = *found_position;
+    grid->entries_positions.erase(hashid);
+    if (position + 1 != grid->entries.size()) {
+        grid->entries[position] = grid->entries.back();
+        *grid->entries_positions.find(grid->entries[position].hashid) =
+            position;
+    }
+    grid->entries.pop_back();
+    grid->is_dirty = true;
+}
+
+void
+_uniform_grid_reindex(cpSpatialIndex* index)
+{
+    auto grid = get_grid(index);
+    for (auto& entry : grid->entries) {
+        if (grid->update_entry(entry)) {
+            grid->is_dirty = true;
+        }
+    }
+}
+
+void
+_uniform_grid_reindex_object(cpSpatialIndex* index, void*, cpHashValue hashid)
+{
+    auto grid = get_grid(index);
+    auto position = grid->entries_positions.find(hashid);
+    if (position != nullptr and grid->update_entry(grid->entries[*position])) {
+        grid->is_dirty = true;
+    }
+}
+
+void
+_uniform_grid_query(
+    cpSpatialIndex* index, void* obj, cpBB bb, cpSpatialIndexQueryFunc func,
+    void* data)
+{
+    get_grid(index)->query(bb, [&](UniformGridEntry& entry) {
+        if (entry.obj != obj) {
+            func(obj, entry.obj, 0, data);
+        }
+    });
+}
+
+void
+_uniform_grid_reindex_query(
+    cpSpatialIndex* index, cpSpatialIndexQueryFunc func, void* data)
+{
+    _uniform_grid_reindex(index);
+    auto grid = get_grid(index);
+    for (size_t i = 0; i < grid->entries.size(); i++) {
+        const auto& entry = grid->entries[i];
+        grid->query(entry.bb, [&](UniformGridEntry& other) {
+            // report every pair once
+            if (&other > &entry) {
+                func(entry.obj, other.obj, 0, data);
+            }
+        });
+    }
+}
+
+void
+_uniform_grid_segment_query(
+    cpSpatialIndex* index, void* obj, cpVect a, cpVect b, cpFloat t_exit,
+    cpSpatialIndexSegmentQueryFunc func, void* data)
+{
+    get_grid(index)->segment_query(a, b, t_exit, [&](UniformGridEntry& entry) {
+        return func(obj, entry.obj, data);
+    });
+}
+
+static cpSpatialIndexClass uniform_grid_class = {
+    _uniform_grid_destroy,       _uniform_grid_count,
+    _uniform_grid_each,          _uniform_grid_contains,
+    _uniform_grid_insert,        _uniform_grid_remove,
+    _uniform_grid_reindex,       _uniform_grid_reindex_object,
+    _uniform_grid_reindex_query, _uniform_grid_query,
+    _uniform_grid_segment_query,
+};
+
+cpSpatialIndex*
+make_uniform_grid_index(
+    const double cell_size, const size_t buckets_count,
+    cpSpatialIndexBBFunc bbfunc)
+{
+    KAACORE_CHECK(cell_size > 0., "Cell size must be positive.");
+    KAACORE_CHECK(buckets_count > 0, "Buckets count must be positive.");
+    // cpSpatialIndexFree releases memory with cpfree
+    void* memory = cpcalloc(1, sizeof(UniformGridIndex));
+    auto grid = new (memory) UniformGridIndex();
+    cpSpatialIndexInit(
+        &grid->spatial_index, &uniform_grid_class, bbfunc, nullptr);
+    grid->cell_size = cell_size;
+    size_t rounded_buckets_count = 1;
+    while (rounded_buckets_count < buckets_count) {
+        rounded_buckets_count <<= 1;
+    }
+    grid->buckets_mask = rounded_buckets_count - 1;
+    KAACORE_LOG_DEBUG(
+        "Created uniform grid index (cell size: {}, buckets: {})", cell_size,
+        rounded_buckets_count);
+    return &grid->spatial_index;
+}
+
+} // namespace kaacore
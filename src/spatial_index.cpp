@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <utility>
 #include <vector>
 
 #include <chipmunk/chipmunk.h>
@@ -7,12 +13,18 @@
 #include "kaacore/log.h"
 #include "kaacore/nodes.h"
 #include "kaacore/shapes.h"
+#include "kaacore/spatial_grid.h"
 
 #include "kaacore/spatial_index.h"
 
 namespace kaacore {
 
 constexpr int circle_shape_generated_points_count = 24;
+// batches smaller than that are not worth rebuilding the tree for
+constexpr size_t bulk_insert_optimize_threshold = 64;
+constexpr double default_bulk_update_threshold = 0.25;
+constexpr size_t spatial_hash_buckets_count = 4096;
+constexpr double nearest_query_initial_radius = 64.;
 
 inline cpBB
 convert_bounding_box(const BoundingBox<double>& bounding_box)
@@ -42,50 +54,162 @@ container_node(const NodeSpatialData* spatial_data)
 void
 NodeSpatialData::refresh()
 {
-    if (this->is_dirty) {
-        Node* node = container_node(this);
+    Node* node = container_node(this);
+    if (node->_is_spatial_data_outdated()) {
         KAACORE_LOG_TRACE(
             "Trigerred refresh of NodeSpatialData of node: {}", fmt::ptr(node));
-        const auto node_transformation = node->absolute_transformation();
-        const auto shape = node->_shape;
-        if (shape) {
-            const auto shape_transformation =
-                Transformation::translate(calculate_realignment_vector(
-                    node->_origin_alignment, shape.vertices_bbox)) |
-                node_transformation;
-            this->bounding_points_transformed.resize(
-                shape.bounding_points.size());
-            std::transform(
-                shape.bounding_points.begin(), shape.bounding_points.end(),
-                this->bounding_points_transformed.begin(),
-                [&shape_transformation](glm::dvec2 pt) -> glm::dvec2 {
-                    return pt | shape_transformation;
-                });
-            this->bounding_box = BoundingBox<double>::from_points(
-                this->bounding_points_transformed);
+        // model matrix was brought up to date by the check above
+        const auto& model_matrix = node->_model_matrix.value;
+        this->transform_x_axis = {model_matrix[0][0], model_matrix[0][1]};
+        this->transform_y_axis = {model_matrix[1][0], model_matrix[1][1]};
+        this->transform_origin = {model_matrix[3][0], model_matrix[3][1]};
+
+        const auto& shape = node->_shape;
+        this->has_shape = bool(shape);
+        this->are_points_outdated = true;
+        if (this->has_shape) {
+            // vertices_bbox is the local bounding box of shape's bounding
+            // points, transforming its corners is enough to get world bbox
+            const auto& local_bbox = shape.vertices_bbox;
+            this->transform_origin += this->transform_vector(
+                calculate_realignment_vector(
+                    node->_origin_alignment, local_bbox));
+            const std::array<glm::dvec2, 4> corners{
+                this->transform_point({local_bbox.min_x, local_bbox.min_y}),
+                this->transform_point({local_bbox.max_x, local_bbox.min_y}),
+                this->transform_point({local_bbox.max_x, local_bbox.max_y}),
+                this->transform_point({local_bbox.min_x, local_bbox.max_y})};
+            glm::dvec2 min_pt = corners[0];
+            glm::dvec2 max_pt = corners[0];
+            for (const auto& pt : corners) {
+                min_pt = glm::min(min_pt, pt);
+                max_pt = glm::max(max_pt, pt);
+            }
+            this->bounding_box =
+                BoundingBox<double>{min_pt.x, min_pt.y, max_pt.x, max_pt.y};
         } else {
             this->bounding_points_transformed.clear();
+            this->are_points_outdated = false;
             this->bounding_box = BoundingBox<double>::single_point(
-                node->_position | node_transformation);
+                this->transform_point(node->_position));
         }
         KAACORE_LOG_TRACE(
             " -> Resulting bbox x:({:.2f}, {:.2f}) y:({:.2f}, {:.2f})",
             this->bounding_box.min_x, this->bounding_box.max_x,
             this->bounding_box.min_y, this->bounding_box.max_y);
 
-        node->_spatial_data.is_dirty = false;
+        this->model_generation = node->_model_matrix.generation;
+        this->is_dirty = false;
+    }
+}
+
+const std::vector<glm::dvec2>&
+NodeSpatialData::transformed_points()
+{
+    if (this->are_points_outdated) {
+        const auto& bounding_points =
+            container_node(this)->_shape.bounding_points;
+        this->bounding_points_transformed.resize(bounding_points.size());
+        for (size_t i = 0; i < bounding_points.size(); i++) {
+            this->bounding_points_transformed[i] =
+                this->transform_point(bounding_points[i]);
+        }
+        this->are_points_outdated = false;
+    }
+    return this->bounding_points_transformed;
+}
+
+bool
+NodeSpatialData::contains_point(const glm::dvec2 point)
+{
+    return this->has_shape and this->bounding_box.contains(point) and
+           check_point_in_polygon(this->transformed_points(), point);
+}
+
+cpSpatialIndex*
+make_cp_spatial_index(const SpatialIndexBackend backend, const double cell_size)
+{
+    switch (backend) {
+        case SpatialIndexBackend::bb_tree:
+            return cpBBTreeNew(_node_wrapper_bbfunc, nullptr);
+        case SpatialIndexBackend::space_hash:
+            return cpSpaceHashNew(
+                cell_size, spatial_hash_buckets_count, _node_wrapper_bbfunc,
+                nullptr);
+        case SpatialIndexBackend::uniform_grid:
+            return make_uniform_grid_index(
+                cell_size, spatial_hash_buckets_count, _node_wrapper_bbfunc);
     }
+    throw exception("Unknown spatial index backend.");
 }
 
 bool
-NodeSpatialData::contains_point(const glm::dvec2 point) const
+NodeSpatialData::intersect_segment(
+    const glm::dvec2 start, const glm::dvec2 end, double& alpha,
+    glm::dvec2& normal)
 {
-    return check_point_in_polygon(this->bounding_points_transformed, point);
+    if (not this->has_shape) {
+        return false;
+    }
+    const auto& points = this->transformed_points();
+    if (points.size() < 2) {
+        return false;
+    }
+
+    // Cyrus-Beck clipping against convex polygon, shapes are
+    // counter-clockwise, but mirroring transformation reverses that
+    const double determinant =
+        this->transform_x_axis.x * this->transform_y_axis.y -
+        this->transform_x_axis.y * this->transform_y_axis.x;
+    const double winding = determinant < 0. ? -1. : 1.;
+    const glm::dvec2 direction = end - start;
+    double t_enter = 0.;
+    double t_exit = 1.;
+    std::optional<glm::dvec2> enter_normal;
+    for (size_t i = 0; i < points.size(); i++) {
+        const glm::dvec2 edge = points[(i + 1) % points.size()] - points[i];
+        const glm::dvec2 edge_normal = winding * glm::dvec2{edge.y, -edge.x};
+        const double numerator = glm::dot(edge_normal, points[i] - start);
+        const double denominator = glm::dot(edge_normal, direction);
+        if (denominator == 0.) {
+            if (numerator < 0.) {
+                // parallel and outside of the edge
+                return false;
+            }
+            continue;
+        }
+        const double t = numerator / denominator;
+        if (denominator < 0.) {
+            if (t > t_enter) {
+                t_enter = t;
+                enter_normal = edge_normal;
+            }
+        } else {
+            t_exit = std::min(t_exit, t);
+        }
+        if (t_enter > t_exit) {
+            return false;
+        }
+    }
+
+    alpha = t_enter;
+    if (enter_normal) {
+        normal = glm::normalize(*enter_normal);
+    } else if (direction != glm::dvec2{0., 0.}) {
+        normal = -glm::normalize(direction);
+    } else {
+        normal = {0., 0.};
+    }
+    return true;
 }
 
-SpatialIndex::SpatialIndex() : _index_counter(0)
+SpatialIndex::SpatialIndex()
+    : _backend(SpatialIndexBackend::bb_tree),
+      _cell_size(default_spatial_index_cell_size), _index_counter(0),
+      _bulk_update_threshold(default_bulk_update_threshold),
+      _snapshot_generation(0), _snapshots_enabled(false)
 {
-    this->_cp_index = cpBBTreeNew(_node_wrapper_bbfunc, nullptr);
+    this->_cp_index = make_cp_spatial_index(this->_backend, this->_cell_size);
 }
 
 SpatialIndex::~SpatialIndex()
@@ -106,6 +230,41 @@ SpatialIndex::start_tracking(Node* node)
     node->_spatial_data.is_indexed = true;
 }
 
+void
+SpatialIndex::start_tracking(const std::vector<Node*>& nodes)
+{
+    size_t indexable_count = 0;
+    for (auto node : nodes) {
+        KAACORE_ASSERT(
+            not node->_spatial_data.is_indexed, "Node is already indexed.");
+        if (node->_indexable) {
+            indexable_count++;
+        }
+    }
+    this->_phony_index.reserve(
+        this->_phony_index.size() + nodes.size() - indexable_count);
+
+    for (auto node : nodes) {
+        if (node->_indexable) {
+            this->_add_to_cp_index(node);
+        } else {
+            this->_add_to_phony_index(node);
+        }
+        node->_spatial_data.is_indexed = true;
+    }
+
+    // incremental insertions leave the tree poorly balanced when large
+    // batch makes up most of the index, rebuild it from scratch instead
+    if (this->_backend == SpatialIndexBackend::bb_tree and
+        indexable_count >= bulk_insert_optimize_threshold and
+        indexable_count * 2 >= size_t(cpSpatialIndexCount(this->_cp_index))) {
+        KAACORE_LOG_DEBUG(
+            "Optimizing spatial index after bulk insert of {} nodes",
+            indexable_count);
+        cpBBTreeOptimize(this->_cp_index);
+    }
+}
+
 void
 SpatialIndex::stop_tracking(Node* node)
 {
@@ -115,6 +274,12 @@ SpatialIndex::stop_tracking(Node* node)
     } else {
         this->_remove_from_phony_index(node);
     }
+    if (node->_spatial_data.is_update_pending) {
+        this->_pending_updates.erase(std::find(
+            this->_pending_updates.begin(), this->_pending_updates.end(),
+            node));
+        node->_spatial_data.is_update_pending = false;
+    }
     node->_spatial_data.is_indexed = false;
     node->_spatial_data.is_dirty = false;
 }
@@ -123,23 +288,7 @@ void
 SpatialIndex::update_single(Node* node)
 {
     KAACORE_ASSERT(node->_spatial_data.is_indexed, "Node is not indexed.");
-
-    // check if `indexable` state hash been changed
-    if (node->_indexable == node->_spatial_data.is_phony_indexed) {
-        if (node->_indexable) {
-            // state change: non-indexable -> indexable
-            KAACORE_LOG_DEBUG(
-                "Node {} switched indexable flag to: true", fmt::ptr(node));
-            this->_remove_from_phony_index(node);
-            this->_add_to_cp_index(node);
-        } else {
-            // state change: indexable -> non-indexable
-            KAACORE_LOG_DEBUG(
-                "Node {} switched indexable flag to: false", fmt::ptr(node));
-            this->_remove_from_cp_index(node);
-            this->_add_to_phony_index(node);
-        }
-    }
+    this->_sync_indexable_state(node);
 
     if (not node->_spatial_data.is_phony_indexed) {
         cpSpatialIndexReindexObject(
@@ -147,6 +296,7 @@ SpatialIndex::update_single(Node* node)
             node->_spatial_data.index_uid);
     } else {
         // phony index needs no updates
+        node->_spatial_data.model_generation = node->_model_matrix.generation;
         node->_spatial_data.is_dirty = false;
     }
 }
@@ -157,20 +307,197 @@ SpatialIndex::refresh_all()
     cpSpatialIndexReindex(this->_cp_index);
 }
 
+SpatialIndexBackend
+SpatialIndex::backend() const
+{
+    return this->_backend;
+}
+
+double
+SpatialIndex::cell_size() const
+{
+    return this->_cell_size;
+}
+
+void
+SpatialIndex::backend(const SpatialIndexBackend backend, const double cell_size)
+{
+    KAACORE_CHECK(cell_size > 0., "Cell size must be positive.");
+    if (backend == this->_backend and cell_size == this->_cell_size) {
+        return;
+    }
+    KAACORE_LOG_INFO(
+        "Switching spatial index backend to {} (cell size: {})", int(backend),
+        cell_size);
+
+    auto new_cp_index = make_cp_spatial_index(backend, cell_size);
+    cpSpatialIndexEach(
+        this->_cp_index,
+        [](void* obj, void* data) {
+            auto wrapper = reinterpret_cast<NodeSpatialData*>(obj);
+            cpSpatialIndexInsert(
+                reinterpret_cast<cpSpatialIndex*>(data), wrapper,
+                wrapper->index_uid);
+        },
+        new_cp_index);
+    cpSpatialIndexFree(this->_cp_index);
+    this->_cp_index = new_cp_index;
+    this->_backend = backend;
+    this->_cell_size = cell_size;
+}
+
+void
+SpatialIndex::queue_update(Node* node)
+{
+    KAACORE_ASSERT(node->_spatial_data.is_indexed, "Node is not indexed.");
+    if (not node->_spatial_data.is_update_pending) {
+        node->_spatial_data.is_update_pending = true;
+        this->_pending_updates.push_back(node);
+    }
+}
+
+void
+SpatialIndex::flush_updates()
+{
+    if (this->_pending_updates.empty()) {
+        return;
+    }
+
+    size_t cp_updates_count = 0;
+    for (auto node : this->_pending_updates) {
+        this->_sync_indexable_state(node);
+        if (not node->_spatial_data.is_phony_indexed) {
+            cp_updates_count++;
+        }
+    }
+    const size_t cp_index_count = cpSpatialIndexCount(this->_cp_index);
+    const double dirty_fraction =
+        cp_index_count > 0 ? double(cp_updates_count) / cp_index_count : 0.;
+    const bool use_bulk_update =
+        cp_updates_count >= bulk_insert_optimize_threshold and
+        dirty_fraction >= this->_bulk_update_threshold;
+
+    for (auto node : this->_pending_updates) {
+        node->_spatial_data.is_update_pending = false;
+        if (node->_spatial_data.is_phony_indexed) {
+            node->_spatial_data.model_generation =
+                node->_model_matrix.generation;
+            node->_spatial_data.is_dirty = false;
+        } else if (not use_bulk_update) {
+            cpSpatialIndexReindexObject(
+                this->_cp_index, &node->_spatial_data,
+                node->_spatial_data.index_uid);
+        }
+    }
+
+    if (use_bulk_update) {
+        KAACORE_LOG_DEBUG(
+            "Rebuilding spatial index, {} of {} nodes changed",
+            cp_updates_count, cp_index_count);
+        // refresh all leaves in single pass, then rebuild tree
+        // from scratch since reinsertions leave it unbalanced
+        cpSpatialIndexReindex(this->_cp_index);
+        if (this->_backend == SpatialIndexBackend::bb_tree) {
+            cpBBTreeOptimize(this->_cp_index);
+        }
+        this->_stats.bulk_updates_count++;
+    } else {
+        this->_stats.incremental_updates_count++;
+    }
+    this->_stats.last_updated_nodes_count = this->_pending_updates.size();
+    this->_stats.last_dirty_fraction = dirty_fraction;
+    this->_stats.last_update_was_bulk = use_bulk_update;
+    this->_pending_updates.clear();
+}
+
+double
+SpatialIndex::bulk_update_threshold() const
+{
+    return this->_bulk_update_threshold;
+}
+
+void
+SpatialIndex::bulk_update_threshold(const double threshold)
+{
+    KAACORE_CHECK(threshold >= 0., "Threshold must be non-negative.");
+    this->_bulk_update_threshold = threshold;
+}
+
+const SpatialIndexStats&
+SpatialIndex::stats() const
+{
+    return this->_stats;
+}
+
+void
+SpatialIndex::publish_snapshot()
+{
+    struct SnapshotBuildState {
+        std::vector<SpatialSnapshotEntry> entries;
+        std::vector<glm::dvec2> points;
+    } state;
+    state.entries.reserve(cpSpatialIndexCount(this->_cp_index));
+
+    // data is taken as it was last indexed, so snapshot
+    // matches what queries against live index would return
+    cpSpatialIndexEach(
+        this->_cp_index,
+        [](void* obj, void* data) {
+            auto wrapper = reinterpret_cast<NodeSpatialData*>(obj);
+            auto state = reinterpret_cast<SnapshotBuildState*>(data);
+            SpatialSnapshotEntry entry{container_node(wrapper)->_handle,
+                                       wrapper->bounding_box,
+                                       uint32_t(state->points.size()), 0};
+            if (wrapper->has_shape) {
+                const auto& points = wrapper->transformed_points();
+                state->points.insert(
+                    state->points.end(), points.begin(), points.end());
+                entry.points_count = points.size();
+            }
+            state->entries.push_back(entry);
+        },
+        &state);
+
+    auto snapshot = std::make_shared<const SpatialIndexSnapshot>(
+        ++this->_snapshot_generation, std::move(state.entries),
+        std::move(state.points));
+    std::atomic_store(&this->_snapshot, std::move(snapshot));
+}
+
+std::shared_ptr<const SpatialIndexSnapshot>
+SpatialIndex::snapshot() const
+{
+    return std::atomic_load(&this->_snapshot);
+}
+
+bool
+SpatialIndex::snapshots_enabled() const
+{
+    return this->_snapshots_enabled;
+}
+
+void
+SpatialIndex::snapshots_enabled(const bool enabled)
+{
+    this->_snapshots_enabled = enabled;
+    if (not enabled) {
+        std::atomic_store(
+            &this->_snapshot, std::shared_ptr<const SpatialIndexSnapshot>());
+    }
+}
+
 std::vector<NodePtr>
 SpatialIndex::query_bounding_box(
     const BoundingBox<double>& bbox, bool include_shapeless)
 {
-    auto wrapper_results = this->_query_wrappers(bbox);
     std::vector<NodePtr> results;
-    results.reserve(wrapper_results.size());
-    for (auto wrapper : wrapper_results) {
-        if (include_shapeless or
-            wrapper->bounding_points_transformed.size() > 1) {
-            results.push_back(container_node(wrapper));
-        }
-    }
-
+    this->query_bounding_box_visit(
+        bbox,
+        [&results](Node* node) {
+            results.push_back(node);
+            return true;
+        },
+        include_shapeless);
     return results;
 }
 
@@ -184,43 +511,356 @@ SpatialIndex::query_bounding_box_for_drawing(const BoundingBox<double>& bbox)
     return results;
 }
 
+std::vector<NodePtr>
+SpatialIndex::query_bounding_box_for_drawing_filtered(
+    const BoundingBox<double>& bbox, const ViewIndexSet& views)
+{
+    std::vector<NodePtr> results;
+    if (views.none()) {
+        return results;
+    }
+    // ordering data is cached, so it's cheap for unchanged nodes
+    auto is_drawn_on_views = [&views](Node* node) {
+        node->recalculate_ordering_data();
+        return (node->_ordering_data.calculated_views & views).any();
+    };
+
+    this->query_bounding_box_visit(
+        bbox,
+        [&](Node* node) {
+            if (is_drawn_on_views(node)) {
+                results.push_back(node);
+            }
+            return true;
+        },
+        false);
+    for (auto node : this->_phony_index) {
+        if (is_drawn_on_views(node)) {
+            results.push_back(node);
+        }
+    }
+    return results;
+}
+
 std::vector<NodePtr>
 SpatialIndex::query_point(const glm::dvec2 point)
 {
-    auto wrapper_results =
-        this->_query_wrappers(BoundingBox{point.x, point.y, point.x, point.y});
     std::vector<NodePtr> results;
-    for (auto wrapper : wrapper_results) {
-        if (wrapper->bounding_points_transformed.size() > 1 and
-            wrapper->contains_point(point)) {
-            results.push_back(container_node(wrapper));
+    this->query_point_visit(point, [&results](Node* node) {
+        results.push_back(node);
+        return true;
+    });
+    return results;
+}
+
+std::vector<NodeHandle>
+SpatialIndex::query_bounding_box_handles(
+    const BoundingBox<double>& bbox, bool include_shapeless)
+{
+    std::vector<NodeHandle> results;
+    this->query_bounding_box_visit(
+        bbox,
+        [&results](Node* node) {
+            results.push_back(node->_handle);
+            return true;
+        },
+        include_shapeless);
+    return results;
+}
+
+std::vector<NodeHandle>
+SpatialIndex::query_point_handles(const glm::dvec2 point)
+{
+    std::vector<NodeHandle> results;
+    this->query_point_visit(point, [&results](Node* node) {
+        results.push_back(node->_handle);
+        return true;
+    });
+    return results;
+}
+
+inline double
+distance_to_bounding_box(
+    const glm::dvec2 point, const BoundingBox<double>& bounding_box)
+{
+    const double dx = std::max(
+        {bounding_box.min_x - point.x, 0., point.x - bounding_box.max_x});
+    const double dy = std::max(
+        {bounding_box.min_y - point.y, 0., point.y - bounding_box.max_y});
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+typedef std::pair<double, NodeSpatialData*> NodeDistancePair;
+
+inline bool
+compare_node_distance(const NodeDistancePair& a, const NodeDistancePair& b)
+{
+    // uid breaks ties, so results do not depend on traversal order
+    return a.first < b.first or
+           (a.first == b.first and a.second->index_uid < b.second->index_uid);
+}
+
+std::vector<NodePtr>
+SpatialIndex::query_nearest(
+    const glm::dvec2 point, const size_t k, const double max_distance)
+{
+    KAACORE_CHECK(max_distance >= 0., "Max distance must be non-negative.");
+    std::vector<NodePtr> results;
+    if (k == 0) {
+        return results;
+    }
+
+    // chipmunk doesn't expose tree traversal, so search window grows
+    // until it holds k nodes closer than its radius, candidates are
+    // kept in bounded max-heap instead of being collected
+    std::vector<NodeDistancePair> heap;
+    heap.reserve(k);
+    const size_t total_count = cpSpatialIndexCount(this->_cp_index);
+    double radius = std::min(nearest_query_initial_radius, max_distance);
+    while (true) {
+        heap.clear();
+        size_t visited_count = 0;
+        this->query_bounding_box_visit(
+            BoundingBox<double>{point.x - radius, point.y - radius,
+                                point.x + radius, point.y + radius},
+            [&](Node* node) {
+                visited_count++;
+                if (not node->_spatial_data.has_shape) {
+                    return true;
+                }
+                const NodeDistancePair candidate{
+                    distance_to_bounding_box(
+                        point, node->_spatial_data.bounding_box),
+                    &node->_spatial_data};
+                if (candidate.first > max_distance) {
+                    return true;
+                }
+                if (heap.size() < k) {
+                    heap.push_back(candidate);
+                    std::push_heap(
+                        heap.begin(), heap.end(), compare_node_distance);
+                } else if (compare_node_distance(candidate, heap.front())) {
+                    std::pop_heap(
+                        heap.begin(), heap.end(), compare_node_distance);
+                    heap.back() = candidate;
+                    std::push_heap(
+                        heap.begin(), heap.end(), compare_node_distance);
+                }
+                return true;
+            });
+
+        // nodes outside of the window are further than its radius
+        if ((heap.size() == k and heap.front().first <= radius) or
+            visited_count >= total_count or radius >= max_distance) {
+            break;
         }
+        radius = std::min(radius * 2., max_distance);
     }
 
+    std::sort_heap(heap.begin(), heap.end(), compare_node_distance);
+    results.reserve(heap.size());
+    for (const auto& [distance, spatial_data] : heap) {
+        results.push_back(container_node(spatial_data));
+    }
     return results;
 }
 
+std::vector<NodePtr>
+SpatialIndex::query_radius(const glm::dvec2 point, const double radius)
+{
+    KAACORE_CHECK(radius >= 0., "Radius must be non-negative.");
+    std::vector<NodeDistancePair> found;
+    this->query_bounding_box_visit(
+        BoundingBox<double>{point.x - radius, point.y - radius,
+                            point.x + radius, point.y + radius},
+        [&](Node* node) {
+            const double distance = distance_to_bounding_box(
+                point, node->_spatial_data.bounding_box);
+            if (distance <= radius) {
+                found.emplace_back(distance, &node->_spatial_data);
+            }
+            return true;
+        },
+        false);
+
+    std::sort(found.begin(), found.end(), compare_node_distance);
+    std::vector<NodePtr> results;
+    results.reserve(found.size());
+    for (const auto& [distance, spatial_data] : found) {
+        results.push_back(container_node(spatial_data));
+    }
+    return results;
+}
+
+struct SpatialRayQueryState {
+    glm::dvec2 start;
+    glm::dvec2 end;
+    std::vector<NodeRayQueryResult>* results;
+};
+
+cpFloat
+_cp_spatial_index_segment_query(void* obj, void* subtree_obj, void*)
+{
+    auto state = reinterpret_cast<SpatialRayQueryState*>(obj);
+    auto wrapper = reinterpret_cast<NodeSpatialData*>(subtree_obj);
+    double alpha;
+    glm::dvec2 normal;
+    if (wrapper->intersect_segment(state->start, state->end, alpha, normal)) {
+        state->results->push_back(
+            {container_node(wrapper),
+             state->start + (state->end - state->start) * alpha, normal,
+             alpha});
+    }
+    // keep the whole ray, all hits are reported
+    return 1.;
+}
+
+std::vector<NodeRayQueryResult>
+SpatialIndex::query_ray(const glm::dvec2 start, const glm::dvec2 end)
+{
+    std::vector<NodeRayQueryResult> results;
+    SpatialRayQueryState state{start, end, &results};
+    cpSpatialIndexSegmentQuery(
+        this->_cp_index, &state, cpv(start.x, start.y), cpv(end.x, end.y), 1.,
+        _cp_spatial_index_segment_query, nullptr);
+
+    // uid breaks ties, so results do not depend on traversal order
+    std::sort(
+        results.begin(), results.end(),
+        [](const NodeRayQueryResult& a, const NodeRayQueryResult& b) {
+            return a.alpha < b.alpha or
+                   (a.alpha == b.alpha and
+                    a.node.get()->_spatial_data.index_uid <
+                        b.node.get()->_spatial_data.index_uid);
+        });
+    return results;
+}
+
+struct SpatialPairsQueryState {
+    bool exact;
+    const SpatialPairFilterFunc* filter;
+    std::vector<std::pair<NodePtr, NodePtr>>* results;
+    cpSpatialIndex* cp_index;
+    NodeSpatialData* wrapper;
+};
+
 cpCollisionID
-_cp_spatial_index_query(
-    void* obj, void* subtree_obj, cpCollisionID cid, void* data)
+_cp_spatial_index_pairs_query(
+    void* obj, void* subtree_obj, cpCollisionID cid, void*)
 {
-    auto wrapper_results =
-        reinterpret_cast<std::vector<NodeSpatialData*>*>(obj);
+    auto state = reinterpret_cast<SpatialPairsQueryState*>(obj);
+    auto wrapper_a = state->wrapper;
+    auto wrapper_b = reinterpret_cast<NodeSpatialData*>(subtree_obj);
+    // every pair is found from both sides, only the earlier one reports it
+    if (wrapper_a->index_uid >= wrapper_b->index_uid or
+        not wrapper_b->has_shape) {
+        return cid;
+    }
+    // candidates come from index leaves, which may be larger than nodes
+    if (not wrapper_a->bounding_box.intersects(wrapper_b->bounding_box)) {
+        return cid;
+    }
+    if (state->exact and not check_polygons_overlap(
+                             wrapper_a->transformed_points(),
+                             wrapper_b->transformed_points())) {
+        return cid;
+    }
+
+    NodePtr node_a = container_node(wrapper_a);
+    NodePtr node_b = container_node(wrapper_b);
+    if (*state->filter and not(*state->filter)(node_a, node_b)) {
+        return cid;
+    }
+    state->results->emplace_back(node_a, node_b);
+    return cid;
+}
+
+std::vector<std::pair<NodePtr, NodePtr>>
+SpatialIndex::query_overlapping_pairs(
+    const bool exact, const SpatialPairFilterFunc& filter)
+{
+    std::vector<std::pair<NodePtr, NodePtr>> results;
+    SpatialPairsQueryState state{
+        exact, &filter, &results, this->_cp_index, nullptr};
+    // node is queried with its own bounding box, unlike reindex query
+    // it only reads the index (bbtree would keep pairs cache for good)
+    cpSpatialIndexEach(
+        this->_cp_index,
+        [](void* obj, void* data) {
+            auto state = reinterpret_cast<SpatialPairsQueryState*>(data);
+            state->wrapper = reinterpret_cast<NodeSpatialData*>(obj);
+            if (not state->wrapper->has_shape) {
+                return;
+            }
+            cpSpatialIndexQuery(
+                state->cp_index, state,
+                convert_bounding_box(state->wrapper->bounding_box),
+                _cp_spatial_index_pairs_query, nullptr);
+        },
+        &state);
+    return results;
+}
+
+struct SpatialQueryState {
+    SpatialQueryVisitorFunc visitor_func;
+    void* visitor;
+    cpBB bbox;
+    bool include_shapeless;
+    const glm::dvec2* point;
+    bool stopped;
+};
+
+cpCollisionID
+_cp_spatial_index_query(void* obj, void* subtree_obj, cpCollisionID cid, void*)
+{
+    auto state = reinterpret_cast<SpatialQueryState*>(obj);
+    // chipmunk has no way of aborting the query,
+    // remaining candidates are skipped instead
+    if (state->stopped) {
+        return cid;
+    }
+
     auto wrapper = reinterpret_cast<NodeSpatialData*>(subtree_obj);
-    wrapper_results->push_back(wrapper);
+    if (state->point != nullptr) {
+        if (not wrapper->contains_point(*state->point)) {
+            return cid;
+        }
+    } else if (
+        (not state->include_shapeless and not wrapper->has_shape) or
+        // hash-based backends report everything from overlapping cells
+        not cpBBIntersects(
+            state->bbox, convert_bounding_box(wrapper->bounding_box))) {
+        return cid;
+    }
+
+    if (not state->visitor_func(container_node(wrapper), state->visitor)) {
+        state->stopped = true;
+    }
     return cid;
 }
 
-std::vector<NodeSpatialData*>
-SpatialIndex::_query_wrappers(const BoundingBox<double>& bbox)
+void
+SpatialIndex::_query_bounding_box(
+    const BoundingBox<double>& bbox, bool include_shapeless,
+    SpatialQueryVisitorFunc visitor_func, void* visitor)
 {
-    std::vector<NodeSpatialData*> wrapper_results;
-    auto cp_bbox = convert_bounding_box(bbox);
+    const auto cp_bbox = convert_bounding_box(bbox);
+    SpatialQueryState state{visitor_func,      visitor, cp_bbox,
+                            include_shapeless, nullptr, false};
     cpSpatialIndexQuery(
-        this->_cp_index, reinterpret_cast<void*>(&wrapper_results), cp_bbox,
-        _cp_spatial_index_query, nullptr);
+        this->_cp_index, &state, cp_bbox, _cp_spatial_index_query, nullptr);
+}
 
-    return wrapper_results;
+void
+SpatialIndex::_query_point(
+    const glm::dvec2 point, SpatialQueryVisitorFunc visitor_func,
+    void* visitor)
+{
+    const auto cp_bbox = cpBBNew(point.x, point.y, point.x, point.y);
+    SpatialQueryState state{visitor_func, visitor, cp_bbox,
+                            false,        &point,  false};
+    cpSpatialIndexQuery(
+        this->_cp_index, &state, cp_bbox, _cp_spatial_index_query, nullptr);
 }
 
 void
@@ -246,16 +886,45 @@ SpatialIndex::_remove_from_cp_index(Node* node)
 void
 SpatialIndex::_add_to_phony_index(Node* node)
 {
-    this->_phony_index.insert(node);
+    node->_spatial_data.phony_index_position = this->_phony_index.size();
+    this->_phony_index.push_back(node);
     node->_spatial_data.is_phony_indexed = true;
 }
 
+void
+SpatialIndex::_sync_indexable_state(Node* node)
+{
+    // check if `indexable` state hash been changed
+    if (node->_indexable == node->_spatial_data.is_phony_indexed) {
+        if (node->_indexable) {
+            // state change: non-indexable -> indexable
+            KAACORE_LOG_DEBUG(
+                "Node {} switched indexable flag to: true", fmt::ptr(node));
+            this->_remove_from_phony_index(node);
+            this->_add_to_cp_index(node);
+        } else {
+            // state change: indexable -> non-indexable
+            KAACORE_LOG_DEBUG(
+                "Node {} switched indexable flag to: false", fmt::ptr(node));
+            this->_remove_from_cp_index(node);
+            this->_add_to_phony_index(node);
+        }
+    }
+}
+
 void
 SpatialIndex::_remove_from_phony_index(Node* node)
 {
     KAACORE_ASSERT(
         node->_spatial_data.is_phony_indexed, "Node is marked as indexable.");
-    this->_phony_index.erase(node);
+    const size_t position = node->_spatial_data.phony_index_position;
+    KAACORE_ASSERT(
+        this->_phony_index[position] == node,
+        "Node is not present in phony index.");
+    auto last_node = this->_phony_index.back();
+    this->_phony_index[position] = last_node;
+    last_node->_spatial_data.phony_index_position = position;
+    this->_phony_index.pop_back();
 }
 
 } // namespace kaacore
@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <utility>
+
+#include "kaacore/spatial_snapshot.h"
+
+namespace kaacore {
+
+constexpr uint32_t bvh_leaf_max_entries = 4;
+
+SpatialIndexSnapshot::SpatialIndexSnapshot(
+    const uint64_t generation, std::vector<SpatialSnapshotEntry>&& entries,
+    std::vector<glm::dvec2>&& points)
+    : _generation(generation), _entries(std::move(entries)),
+      _points(std::move(points))
+{
+    if (not this->_entries.empty()) {
+        this->_nodes.reserve(
+            2 * (this->_entries.size() / bvh_leaf_max_entries + 1));
+        this->_build(0, this->_entries.size());
+    }
+}
+
+uint32_t
+SpatialIndexSnapshot::_build(const uint32_t begin, const uint32_t end)
+{
+    const uint32_t node_index = this->_nodes.size();
+    this->_nodes.emplace_back();
+
+    auto bbox = this->_entries[begin].bounding_box;
+    for (uint32_t i = begin + 1; i < end; i++) {
+        bbox = bbox.merge(this->_entries[i].bounding_box);
+    }
+    this->_nodes[node_index].bounding_box = bbox;
+
+    if (end - begin <= bvh_leaf_max_entries) {
+        this->_nodes[node_index].first = begin;
+        this->_nodes[node_index].entries_count = end - begin;
+        return node_index;
+    }
+
+    // median split along the longer axis keeps the tree balanced,
+    // so its depth never exceeds bvh_max_depth
+    const bool split_x = bbox.max_x - bbox.min_x >= bbox.max_y - bbox.min_y;
+    const uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(
+        this->_entries.begin() + begin, this->_entries.begin() + middle,
+        this->_entries.begin() + end,
+        [split_x](
+            const SpatialSnapshotEntry& a, const SpatialSnapshotEntry& b) {
+            if (split_x) {
+                return a.bounding_box.min_x + a.bounding_box.max_x <
+                       b.bounding_box.min_x + b.bounding_box.max_x;
+            }
+            return a.bounding_box.min_y + a.bounding_box.max_y <
+                   b.bounding_box.min_y + b.bounding_box.max_y;
+        });
+
+    this->_build(begin, middle);
+    const uint32_t right_index = this->_build(middle, end);
+    this->_nodes[node_index].first = right_index;
+    this->_nodes[node_index].entries_count = 0;
+    return node_index;
+}
+
+uint64_t
+SpatialIndexSnapshot::generation() const
+{
+    return this->_generation;
+}
+
+size_t
+SpatialIndexSnapshot::size() const
+{
+    return this->_entries.size();
+}
+
+bool
+SpatialIndexSnapshot::entry_contains_point(
+    const SpatialSnapshotEntry& entry, const glm::dvec2 point) const
+{
+    if (entry.points_count < 3) {
+        return false;
+    }
+    // shapes are convex, point has to be on the same side of every edge
+    const glm::dvec2* points = this->_points.data() + entry.points_offset;
+    int turn = 0;
+    for (uint32_t i = 0; i < entry.points_count; i++) {
+        const auto edge = points[(i + 1) % entry.points_count] - points[i];
+        const auto to_point = point - points[i];
+        const double cross = edge.x * to_point.y - edge.y * to_point.x;
+        if (cross == 0.) {
+            continue;
+        }
+        const int new_turn = cross > 0. ? 1 : -1;
+        if (turn != 0 and new_turn != turn) {
+            return false;
+        }
+        turn = new_turn;
+    }
+    return true;
+}
+
+std::vector<NodeHandle>
+SpatialIndexSnapshot::query_bounding_box(
+    const BoundingBox<double>& bbox, bool include_shapeless) const
+{
+    std::vector<NodeHandle> results;
+    this->query_bounding_box_visit(
+        bbox, [&](const SpatialSnapshotEntry& entry) {
+            if (include_shapeless or entry.points_count > 0) {
+                results.push_back(entry.handle);
+            }
+            return true;
+        });
+    return results;
+}
+
+std::vector<NodeHandle>
+SpatialIndexSnapshot::query_point(const glm::dvec2 point) const
+{
+    std::vector<NodeHandle> results;
+    this->query_bounding_box_visit(
+        BoundingBox<double>::single_point(point),
+        [&](const SpatialSnapshotEntry& entry) {
+            if (this->entry_contains_point(entry, point)) {
+                results.push_back(entry.handle);
+            }
+            return true;
+        });
+    return results;
+}
+
+} // namespace kaacore
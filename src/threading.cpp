@@ -1,4 +1,5 @@
 #include <mutex>
+#include <utility>
 
 #include "kaacore/threading.h"
 
@@ -14,4 +15,100 @@ SyncedSyscallQueue::finalize_calls()
     this->_queued_functions.clear();
 }
 
+WorkerPool::WorkerPool(const size_t workers_count)
+{
+    KAACORE_LOG_DEBUG("Starting worker pool with {} thread(s)", workers_count);
+    this->_threads.reserve(workers_count);
+    for (size_t i = 0; i < workers_count; i++) {
+        this->_threads.emplace_back(&WorkerPool::_worker_loop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard lock{this->_mutex};
+        this->_is_stopping = true;
+    }
+    this->_work_condition.notify_all();
+    for (auto& thread : this->_threads) {
+        thread.join();
+    }
+}
+
+size_t
+WorkerPool::workers_count() const
+{
+    return this->_threads.size();
+}
+
+void
+WorkerPool::parallel_for(
+    const size_t count, const std::function<void(size_t)>& func)
+{
+    if (count == 0) {
+        return;
+    }
+    {
+        std::lock_guard lock{this->_mutex};
+        this->_func = &func;
+        this->_tasks_count = count;
+        this->_next_task = 0;
+        this->_busy_workers = this->_threads.size();
+        this->_exception = nullptr;
+        this->_batch_id++;
+    }
+    this->_work_condition.notify_all();
+    this->_process_tasks();
+
+    std::unique_lock lock{this->_mutex};
+    this->_done_condition.wait(
+        lock, [this] { return this->_busy_workers == 0; });
+    this->_func = nullptr;
+    if (this->_exception) {
+        std::rethrow_exception(std::exchange(this->_exception, nullptr));
+    }
+}
+
+void
+WorkerPool::_worker_loop()
+{
+    uint64_t last_batch_id = 0;
+    while (true) {
+        {
+            std::unique_lock lock{this->_mutex};
+            this->_work_condition.wait(lock, [this, last_batch_id] {
+                return this->_is_stopping or this->_batch_id != last_batch_id;
+            });
+            if (this->_is_stopping) {
+                return;
+            }
+            last_batch_id = this->_batch_id;
+        }
+        this->_process_tasks();
+        {
+            std::lock_guard lock{this->_mutex};
+            if (--this->_busy_workers == 0) {
+                this->_done_condition.notify_one();
+            }
+        }
+    }
+}
+
+void
+WorkerPool::_process_tasks()
+{
+    size_t task;
+    while ((task = this->_next_task++) < this->_tasks_count) {
+        try {
+            (*this->_func)(task);
+        } catch (...) {
+            std::lock_guard lock{this->_mutex};
+            if (not this->_exception) {
+                this->_exception = std::current_exception();
+            }
+        }
+    }
+}
+
 } // namespace kaacore
@@ -0,0 +1,378 @@
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "kaacore/nodes.h"
+#include "kaacore/physics.h"
+#include "kaacore/prefabs.h"
+#include "kaacore/shapes.h"
+
+#include "runner.h"
+
+using namespace kaacore;
+
+// benchmarks are hidden by default, run them with: runner "[benchmark]"
+
+NodeOwnerPtr
+make_wide_subtree(const size_t bodies_count)
+{
+    auto space = make_node(NodeType::space);
+    for (size_t i = 0; i < bodies_count; i++) {
+        auto body = make_node(NodeType::body);
+        body->position({(i % 100) * 10., (i / 100) * 10.});
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Circle(4.));
+        body->add_child(hitbox);
+        space->add_child(body);
+    }
+    return space;
+}
+
+NodeOwnerPtr
+make_deep_subtree(const size_t depth)
+{
+    auto root = make_node();
+    Node* parent = root.get();
+    for (size_t i = 0; i < depth; i++) {
+        auto node = make_node();
+        node->position({1., 1.});
+        node->shape(Shape::Box({2., 2.}));
+        parent = parent->add_child(node).get();
+    }
+    return root;
+}
+
+NodeOwnerPtr
+make_enemy()
+{
+    auto body = make_node(NodeType::body);
+    body->body.mass(5.);
+    auto hitbox = make_node(NodeType::hitbox);
+    hitbox->shape(Shape::Box({10., 10.}));
+    hitbox->hitbox.elasticity(0.5);
+    body->add_child(hitbox);
+    auto text = make_node(NodeType::text);
+    text->text.content("enemy");
+    body->add_child(text);
+    return body;
+}
+
+TEST_CASE("Benchmark attaching large subtree", "[.][benchmark][nodes]")
+{
+    auto engine = initialize_testing_engine();
+
+    BENCHMARK_ADVANCED("wide subtree (1000 bodies with hitboxes)")
+    (Catch::Benchmark::Chronometer meter)
+    {
+        TestingScene scene;
+        std::vector<NodeOwnerPtr> subtrees;
+        for (int i = 0; i < meter.runs(); i++) {
+            subtrees.push_back(make_wide_subtree(1000));
+        }
+        meter.measure(
+            [&](int i) { return scene.root_node.add_child(subtrees[i]); });
+    };
+
+    BENCHMARK_ADVANCED("deep subtree (1000 levels)")
+    (Catch::Benchmark::Chronometer meter)
+    {
+        TestingScene scene;
+        std::vector<NodeOwnerPtr> subtrees;
+        for (int i = 0; i < meter.runs(); i++) {
+            subtrees.push_back(make_deep_subtree(1000));
+        }
+        meter.measure(
+            [&](int i) { return scene.root_node.add_child(subtrees[i]); });
+    };
+}
+
+TEST_CASE("Benchmark spawning enemies wave", "[.][benchmark][prefabs]")
+{
+    auto engine = initialize_testing_engine();
+
+    BENCHMARK("1000 enemies with setters")
+    {
+        std::vector<NodeOwnerPtr> enemies;
+        for (int i = 0; i < 1000; i++) {
+            enemies.push_back(make_enemy());
+        }
+        return enemies;
+    };
+
+    auto prefab = Prefab::capture(make_enemy());
+    BENCHMARK("1000 enemies from prefab") { return prefab.instantiate(1000); };
+}
+
+TEST_CASE("Benchmark moving all indexed nodes", "[.][benchmark][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < 5000; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({5., 5.}));
+        node->position({(i % 100) * 10., (i / 100) * 10.});
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+    scene.resolve_dirty_nodes();
+
+    auto move_all = [&]() {
+        for (auto& node : nodes) {
+            node->position(node->position() + glm::dvec2{1., 0.});
+        }
+        scene.resolve_dirty_nodes();
+        return scene.spatial_index.stats().last_update_was_bulk;
+    };
+
+    scene.spatial_index.bulk_update_threshold(2.);
+    BENCHMARK("5000 nodes, incremental reindex") { return move_all(); };
+
+    scene.spatial_index.bulk_update_threshold(0.25);
+    BENCHMARK("5000 nodes, bulk reindex") { return move_all(); };
+}
+
+TEST_CASE("Benchmark spatial index backends", "[.][benchmark][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+
+    for (auto [backend, name] :
+         {std::make_pair(SpatialIndexBackend::bb_tree, "bb tree"),
+          std::make_pair(SpatialIndexBackend::space_hash, "space hash"),
+          std::make_pair(SpatialIndexBackend::uniform_grid, "uniform grid")}) {
+        TestingScene scene;
+        scene.spatial_index.backend(backend, 8.);
+        // bullet-hell like workload: many small nodes of the same size
+        std::vector<NodePtr> nodes;
+        for (int i = 0; i < 5000; i++) {
+            auto node = make_node();
+            node->shape(Shape::Circle(2.));
+            node->position({(i % 100) * 10., (i / 100) * 10.});
+            nodes.push_back(scene.root_node.add_child(node));
+        }
+        scene.resolve_dirty_nodes();
+
+        BENCHMARK(std::string("update 5000 nodes - ") + name)
+        {
+            for (auto& node : nodes) {
+                node->position(node->position() + glm::dvec2{3., 1.});
+            }
+            scene.resolve_dirty_nodes();
+        };
+
+        BENCHMARK(std::string("1000 point queries - ") + name)
+        {
+            size_t found = 0;
+            for (int i = 0; i < 1000; i++) {
+                scene.spatial_index.query_point_visit(
+                    glm::dvec2{(i % 100) * 10., (i / 10) * 5.},
+                    [&found](Node*) {
+                        found++;
+                        return true;
+                    });
+            }
+            return found;
+        };
+    }
+}
+
+TEST_CASE("Benchmark physics solver threads", "[.][benchmark][physics]")
+{
+    auto engine = initialize_testing_engine();
+
+    for (size_t threads : {1, 2, 4}) {
+        TestingScene scene;
+        auto space = make_node(NodeType::space);
+        space->space.gravity({0., 100.});
+        // densely packed pile, every body collides with its neighbours
+        for (int i = 0; i < 3000; i++) {
+            auto body = make_node(NodeType::body);
+            body->body.body_type(BodyNodeType::dynamic);
+            body->body.mass(1.);
+            body->body.moment(10.);
+            body->position({(i % 60) * 9., (i / 60) * 9.});
+            auto hitbox = make_node(NodeType::hitbox);
+            hitbox->shape(Shape::Circle(5.));
+            body->add_child(hitbox);
+            space->add_child(body);
+        }
+        NodePtr space_node = scene.root_node.add_child(space);
+        space_node->space.solver_threads(threads);
+        space_node->space.iterations(10);
+
+        BENCHMARK(
+            "3000 colliding bodies, " + std::to_string(threads) + " thread(s)")
+        {
+            scene.process_physics(16ms);
+        };
+    }
+}
+
+TEST_CASE("Benchmark animated hitboxes", "[.][benchmark][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    auto space = make_wide_subtree(1000);
+    NodePtr space_node = scene.root_node.add_child(space);
+    std::vector<NodePtr> hitboxes;
+    for (auto body : space_node->children()) {
+        hitboxes.push_back(body->children()[0]);
+    }
+
+    double scale = 1.;
+    BENCHMARK("pulsing 1000 hitboxes")
+    {
+        scale = scale > 2. ? 1. : scale + 0.1;
+        for (auto& hitbox : hitboxes) {
+            hitbox->scale({scale, scale});
+        }
+        scene.process_physics(10ms);
+    };
+}
+
+TEST_CASE("Benchmark collision events", "[.][benchmark][physics]")
+{
+    auto engine = initialize_testing_engine();
+
+    // enlarged hitboxes make every body touch its neighbours
+    auto make_crowded_space = [](TestingScene& scene) {
+        auto space = make_wide_subtree(2000);
+        for (auto body : space->children()) {
+            body->body.body_type(BodyNodeType::dynamic);
+            body->body.mass(1.);
+            body->body.moment(1.);
+            body->children()[0]->shape(Shape::Circle(6.));
+            body->children()[0]->hitbox.trigger_id(1);
+        }
+        return scene.root_node.add_child(space);
+    };
+
+    BENCHMARK_ADVANCED("collision handler")
+    (Catch::Benchmark::Chronometer meter)
+    {
+        TestingScene scene;
+        auto space = make_crowded_space(scene);
+        size_t collisions = 0;
+        space->space.set_collision_handler(
+            1, 1,
+            [&collisions](const Arbiter, CollisionPair, CollisionPair) {
+                collisions++;
+                return 1;
+            },
+            CollisionPhase::begin | CollisionPhase::separate);
+        meter.measure([&] { scene.process_physics(10ms); });
+    };
+
+    BENCHMARK_ADVANCED("recorded events")
+    (Catch::Benchmark::Chronometer meter)
+    {
+        TestingScene scene;
+        auto space = make_crowded_space(scene);
+        space->space.record_collision_events(1, 1);
+        meter.measure([&] {
+            scene.process_physics(10ms);
+            space->space.clear_collision_events();
+        });
+    };
+}
+
+TEST_CASE("Benchmark physics queries", "[.][benchmark][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    auto subtree = make_wide_subtree(1000);
+    NodePtr space = scene.root_node.add_child(subtree);
+    const auto query_shape = Shape::Box({30., 30.});
+
+    BENCHMARK("shape overlaps")
+    {
+        return space->space.query_shape_overlaps(query_shape).size();
+    };
+
+    std::vector<ShapeQueryResult> shape_results;
+    BENCHMARK("shape overlaps (reused buffer)")
+    {
+        space->space.query_shape_overlaps(shape_results, query_shape);
+        return shape_results.size();
+    };
+
+    BENCHMARK("ray")
+    {
+        return space->space.query_ray({-10., 5.}, {1000., 5.}).size();
+    };
+
+    BENCHMARK("ray first hit")
+    {
+        return space->space.query_ray_first({-10., 5.}, {1000., 5.})
+            .has_value();
+    };
+}
+
+TEST_CASE("Benchmark batched rays", "[.][benchmark][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    scene.physics_workers_count(4);
+    auto subtree = make_wide_subtree(1000);
+    NodePtr space = scene.root_node.add_child(subtree);
+
+    std::vector<glm::dvec2> starts;
+    std::vector<glm::dvec2> ends;
+    for (int i = 0; i < 2000; i++) {
+        starts.push_back({-10., (i % 100) * 1.});
+        ends.push_back({1000., (i % 100) * 1. + (i / 100) * 5.});
+    }
+    std::vector<std::optional<RayQueryResult>> results;
+
+    BENCHMARK("2000 separate rays")
+    {
+        size_t hits = 0;
+        for (size_t i = 0; i < starts.size(); i++) {
+            hits +=
+                space->space.query_ray_first(starts[i], ends[i]).has_value();
+        }
+        return hits;
+    };
+
+    BENCHMARK("2000 batched rays")
+    {
+        space->space.query_rays_first(starts, ends, results);
+        return results.size();
+    };
+
+    BENCHMARK("2000 batched rays (4 workers)")
+    {
+        space->space.query_rays_first(
+            starts, ends, results, 0., collision_bitmask_all,
+            collision_bitmask_all, collision_group_none, true);
+        return results.size();
+    };
+}
+
+TEST_CASE("Benchmark space snapshots", "[.][benchmark][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    auto subtree = make_wide_subtree(1000);
+    NodePtr space = scene.root_node.add_child(subtree);
+    space->space.gravity({0., 100.});
+    for (auto body : space->children()) {
+        body->body.body_type(BodyNodeType::dynamic);
+        body->body.mass(1.);
+        body->body.moment(1.);
+        body->children()[0]->shape(Shape::Circle(6.));
+    }
+    scene.process_physics(50ms);
+
+    SpaceSnapshot snapshot;
+    BENCHMARK("save 1000 bodies")
+    {
+        space->space.save_snapshot(snapshot);
+    };
+
+    BENCHMARK("restore 1000 bodies")
+    {
+        space->space.restore_snapshot(snapshot);
+    };
+}
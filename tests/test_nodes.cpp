@@ -0,0 +1,1284 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "kaacore/geometry.h"
+#include "kaacore/nodes.h"
+#include "kaacore/physics.h"
+#include "kaacore/prefabs.h"
+#include "kaacore/serialization.h"
+#include "kaacore/shapes.h"
+
+#include "runner.h"
+
+using namespace kaacore;
+
+TEST_CASE("Test attaching subtree to scene", "[nodes]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    std::vector<NodePtr> bodies;
+    std::vector<NodePtr> hitboxes;
+    for (int i = 0; i < 100; i++) {
+        auto body = make_node(NodeType::body);
+        body->position({i * 10., 0.});
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Box({5., 5.}));
+        hitboxes.push_back(body->add_child(hitbox));
+        bodies.push_back(space->add_child(body));
+    }
+    for (const auto& body : bodies) {
+        REQUIRE(body->body.space() == &space->space);
+    }
+    REQUIRE(hitboxes.front()->hitbox.space() == &space->space);
+
+    NodePtr space_ptr = scene.root_node.add_child(space);
+    REQUIRE(space_ptr->scene() == &scene);
+    REQUIRE(hitboxes.back()->scene() == &scene);
+
+    const BoundingBox<double> bbox{-100., -100., 1100., 100.};
+    // root, space, bodies and hitboxes
+    REQUIRE(scene.spatial_index.query_bounding_box(bbox).size() == 202);
+    // only hitboxes have shapes
+    REQUIRE(scene.spatial_index.query_bounding_box(bbox, false).size() == 100);
+    REQUIRE(
+        scene.spatial_index.query_point({500., 0.}).front() == hitboxes[50]);
+}
+
+TEST_CASE("Test lazy propagation of dirty state", "[nodes]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    SECTION("Deep hierarchy")
+    {
+        const int depth = 10000;
+        auto top = make_node();
+        NodePtr top_ptr = scene.root_node.add_child(top);
+        NodePtr deepest = top_ptr;
+        for (int i = 0; i < depth; i++) {
+            auto node = make_node();
+            node->position({1., 0.});
+            deepest = deepest->add_child(node);
+        }
+        REQUIRE(deepest->absolute_position() == glm::dvec2{depth, 0.});
+
+        top_ptr->position({0., 5.});
+        REQUIRE(deepest->absolute_position() == glm::dvec2{depth, 5.});
+    }
+
+    SECTION("Ancestor transformation")
+    {
+        auto grandparent = make_node();
+        grandparent->position({10., 0.});
+        NodePtr grandparent_ptr = scene.root_node.add_child(grandparent);
+        auto parent = make_node();
+        parent->position({0., 10.});
+        NodePtr parent_ptr = grandparent_ptr->add_child(parent);
+        auto child = make_node();
+        child->position({1., 1.});
+        NodePtr child_ptr = parent_ptr->add_child(child);
+        REQUIRE(child_ptr->absolute_position() == glm::dvec2{11., 11.});
+
+        grandparent_ptr->position({20., 0.});
+        REQUIRE(child_ptr->absolute_position() == glm::dvec2{21., 11.});
+        grandparent_ptr->scale({2., 2.});
+        REQUIRE(child_ptr->absolute_position() == glm::dvec2{22., 22.});
+        // sibling subtree verified in between must not hide the change
+        auto sibling = make_node();
+        NodePtr sibling_ptr = scene.root_node.add_child(sibling);
+        REQUIRE(sibling_ptr->absolute_position() == glm::dvec2{0., 0.});
+        parent_ptr->position({0., 0.});
+        REQUIRE(sibling_ptr->absolute_position() == glm::dvec2{0., 0.});
+        REQUIRE(child_ptr->absolute_position() == glm::dvec2{22., 2.});
+    }
+
+    SECTION("Inherited ordering data")
+    {
+        auto grandparent = make_node();
+        NodePtr grandparent_ptr = scene.root_node.add_child(grandparent);
+        auto parent = make_node();
+        NodePtr parent_ptr = grandparent_ptr->add_child(parent);
+        auto child = make_node();
+        child->shape(Shape::Box({2., 2.}));
+        NodePtr child_ptr = parent_ptr->add_child(child);
+        REQUIRE(child_ptr->absolute_z_index() == 0);
+
+        grandparent_ptr->z_index(5);
+        REQUIRE(child_ptr->absolute_z_index() == 5);
+        parent_ptr->z_index(3);
+        REQUIRE(child_ptr->absolute_z_index() == 3);
+        parent_ptr->z_index(std::nullopt);
+        grandparent_ptr->z_index(-2);
+        REQUIRE(child_ptr->absolute_z_index() == -2);
+
+        auto query_views = [&scene](const std::unordered_set<int16_t>& views) {
+            return scene.spatial_index
+                .query_bounding_box_for_drawing_filtered(
+                    {-1., -1., 1., 1.}, views);
+        };
+        REQUIRE(query_views({1}).empty());
+        grandparent_ptr->views(std::unordered_set<int16_t>{1});
+        REQUIRE(query_views({1}).size() == 1);
+        grandparent_ptr->views(std::unordered_set<int16_t>{2});
+        REQUIRE(query_views({1}).empty());
+        REQUIRE(query_views({2}).front() == child_ptr);
+    }
+}
+
+TEST_CASE("Test prefab instantiation", "[nodes][prefabs]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto body = make_node(NodeType::body);
+    body->body.mass(5.);
+    body->rotation(1.);
+    auto hitbox = make_node(NodeType::hitbox);
+    hitbox->shape(Shape::Circle(3.));
+    hitbox->hitbox.elasticity(0.5);
+    hitbox->hitbox.trigger_id(7);
+    body->add_child(hitbox);
+    auto text = make_node(NodeType::text);
+    text->text.content("enemy");
+    text->z_index(10);
+    body->add_child(text);
+
+    auto prefab = Prefab::capture(body);
+    REQUIRE(prefab);
+    REQUIRE(prefab.nodes_count() == 3);
+
+    auto space_node = make_node(NodeType::space);
+    auto space = scene.root_node.add_child(space_node);
+    auto instances = prefab.instantiate(10);
+    REQUIRE(instances.size() == 10);
+    for (auto& instance : instances) {
+        REQUIRE(instance->rotation() == body->rotation());
+        REQUIRE(instance->body.mass() == 5.);
+        REQUIRE(instance->children().size() == 2);
+
+        Node* cloned_hitbox = instance->children()[0];
+        REQUIRE(cloned_hitbox->type() == NodeType::hitbox);
+        REQUIRE(cloned_hitbox->shape().type == ShapeType::circle);
+        REQUIRE(cloned_hitbox->hitbox.elasticity() == 0.5);
+        REQUIRE(cloned_hitbox->hitbox.trigger_id() == 7);
+
+        Node* cloned_text = instance->children()[1];
+        REQUIRE(cloned_text->text.content() == "enemy");
+        REQUIRE(cloned_text->z_index() == 10);
+
+        auto attached = space->add_child(instance);
+        REQUIRE(attached->body.space() == &space->space);
+        REQUIRE(cloned_hitbox->hitbox.space() == &space->space);
+        REQUIRE(cloned_text->scene() == &scene);
+    }
+}
+
+TEST_CASE("Test prefab physics settings", "[nodes][prefabs][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    space->space.gravity({0., 10.});
+    space->space.damping(0.5);
+    space->space.sleeping_threshold(2.);
+    space->space.iterations(20);
+    space->space.step_size(5ms);
+    space->space.interpolation(PhysicsInterpolation::interpolate);
+    auto falling_body = make_node(NodeType::body);
+    falling_body->body.mass(1.);
+    space->add_child(falling_body);
+    auto rising_body = make_node(NodeType::body);
+    rising_body->body.mass(1.);
+    rising_body->body.gravity(glm::dvec2{0., -10.});
+    rising_body->body.damping(1.);
+    space->add_child(rising_body);
+
+    auto prefab = Prefab::capture(space);
+    auto instance = prefab.instantiate();
+    NodePtr cloned_space = scene.root_node.add_child(instance);
+    REQUIRE(cloned_space->space.gravity() == glm::dvec2{0., 10.});
+    REQUIRE(cloned_space->space.damping() == 0.5);
+    REQUIRE(cloned_space->space.sleeping_threshold() == 2.);
+    REQUIRE(cloned_space->space.iterations() == 20);
+    REQUIRE(cloned_space->space.step_size() == 5ms);
+    REQUIRE(
+        cloned_space->space.interpolation() ==
+        PhysicsInterpolation::interpolate);
+
+    Node* cloned_falling = cloned_space->children()[0];
+    Node* cloned_rising = cloned_space->children()[1];
+    REQUIRE(cloned_rising->body.gravity() == glm::dvec2{0., -10.});
+    REQUIRE(cloned_rising->body.damping() == 1.);
+    scene.process_physics(100ms);
+    REQUIRE(cloned_falling->body.velocity().y > 0.);
+    REQUIRE(cloned_rising->body.velocity().y < 0.);
+}
+
+TEST_CASE("Test nodes serialization", "[nodes][serialization]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto body = make_node(NodeType::body);
+    body->position({10., 20.});
+    body->body.mass(5.);
+    body->body.velocity({1., 2.});
+    body->body.gravity(glm::dvec2{0., -10.});
+    body->body.damping(1.);
+    auto hitbox = make_node(NodeType::hitbox);
+    hitbox->shape(Shape::Box({4., 6.}));
+    hitbox->hitbox.trigger_id(7);
+    hitbox->hitbox.friction(0.25);
+    body->add_child(hitbox);
+    auto text = make_node(NodeType::text);
+    text->text.content("enemy");
+    text->color({1., 0., 0., 1.});
+    text->z_index(10);
+    text->views(std::unordered_set<int16_t>{0, 3});
+    body->add_child(text);
+
+    const auto data = serialize_nodes(body);
+    auto loaded = deserialize_nodes(data.data(), data.size());
+    REQUIRE(loaded->type() == NodeType::body);
+    REQUIRE(loaded->position() == glm::dvec2{10., 20.});
+    REQUIRE(loaded->body.mass() == 5.);
+    REQUIRE(loaded->body.velocity() == glm::dvec2{1., 2.});
+    REQUIRE(loaded->body.gravity() == glm::dvec2{0., -10.});
+    REQUIRE(loaded->body.damping() == 1.);
+    REQUIRE(loaded->children().size() == 2);
+
+    Node* loaded_hitbox = loaded->children()[0];
+    REQUIRE(loaded_hitbox->shape().type == ShapeType::polygon);
+    REQUIRE(loaded_hitbox->shape().points == hitbox->shape().points);
+    REQUIRE(loaded_hitbox->hitbox.trigger_id() == 7);
+    REQUIRE(loaded_hitbox->hitbox.friction() == 0.25);
+
+    Node* loaded_text = loaded->children()[1];
+    REQUIRE(loaded_text->text.content() == "enemy");
+    REQUIRE(loaded_text->color() == glm::dvec4{1., 0., 0., 1.});
+    REQUIRE(loaded_text->z_index() == 10);
+    REQUIRE(loaded_text->views().value().size() == 2);
+    REQUIRE(
+        loaded_text->shape().vertices.size() ==
+        text->shape().vertices.size());
+
+    auto space_node = make_node(NodeType::space);
+    auto space = scene.root_node.add_child(space_node);
+    auto attached = space->add_child(loaded);
+    REQUIRE(attached->body.space() == &space->space);
+    REQUIRE(loaded_hitbox->hitbox.space() == &space->space);
+    // gravity override is applied, space itself has no gravity
+    scene.process_physics(100ms);
+    REQUIRE(attached->body.velocity().y < 2.);
+
+    REQUIRE_THROWS_AS(
+        deserialize_nodes(data.data(), data.size() / 2), exception);
+}
+
+TEST_CASE("Test node handles", "[nodes][node_handles]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto node = make_node();
+    REQUIRE(not node->handle());
+    node->shape(Shape::Box({2., 2.}));
+    auto child = make_node();
+    node->add_child(child);
+    NodePtr node_ptr = scene.root_node.add_child(node);
+
+    const NodeHandle handle = node_ptr->handle();
+    REQUIRE(handle);
+    REQUIRE(scene.node_slots.resolve(handle) == node_ptr.get());
+    REQUIRE(NodeHandle::from_value(handle.value()) == handle);
+    // root and both nodes
+    REQUIRE(scene.node_slots.size() == 3);
+
+    auto results = scene.spatial_index.query_point_handles({0., 0.});
+    REQUIRE(results.size() == 1);
+    REQUIRE(results[0] == handle);
+
+    node_ptr.destroy();
+    REQUIRE(not scene.node_slots.is_valid(handle));
+    REQUIRE(scene.node_slots.resolve(handle) == nullptr);
+    REQUIRE(scene.node_slots.size() == 1);
+
+    // reused slot must not resolve stale handle
+    auto other = make_node();
+    NodePtr other_ptr = scene.root_node.add_child(other);
+    REQUIRE(other_ptr->handle() != handle);
+    REQUIRE(scene.node_slots.resolve(handle) == nullptr);
+}
+
+TEST_CASE("Test visitor spatial queries", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    for (int i = 0; i < 10; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({2., 2.}));
+        scene.root_node.add_child(node);
+    }
+    const BoundingBox<double> bbox{-1., -1., 1., 1.};
+
+    size_t visited = 0;
+    scene.spatial_index.query_bounding_box_visit(
+        bbox,
+        [&visited](Node* node) {
+            visited++;
+            return visited < 3;
+        },
+        false);
+    REQUIRE(visited == 3);
+
+    std::array<Node*, 4> buffer;
+    REQUIRE(
+        scene.spatial_index.query_point_into(
+            {0., 0.}, buffer.begin(), buffer.size()) == 4);
+    REQUIRE(
+        scene.spatial_index.query_bounding_box_into(
+            bbox, buffer.begin(), buffer.size(), false) == 4);
+    REQUIRE(scene.spatial_index.query_point({0., 0.}).size() == 10);
+}
+
+TEST_CASE("Test spatial index bulk updates", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < 200; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({2., 2.}));
+        node->position({i * 10., 0.});
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+    scene.resolve_dirty_nodes();
+
+    for (auto& node : nodes) {
+        node->position(node->position() + glm::dvec2{0., 100.});
+    }
+    scene.resolve_dirty_nodes();
+    REQUIRE(scene.spatial_index.stats().last_update_was_bulk);
+    REQUIRE(scene.spatial_index.stats().last_updated_nodes_count == 200);
+    REQUIRE(scene.spatial_index.query_point({500., 100.}).front() == nodes[50]);
+    REQUIRE(scene.spatial_index.query_point({500., 0.}).empty());
+
+    nodes[10]->position({-100., -100.});
+    scene.resolve_dirty_nodes();
+    REQUIRE(not scene.spatial_index.stats().last_update_was_bulk);
+    REQUIRE(scene.spatial_index.stats().last_updated_nodes_count == 1);
+    REQUIRE(
+        scene.spatial_index.query_point({-100., -100.}).front() == nodes[10]);
+}
+
+TEST_CASE("Test spatial index backends", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < 100; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({4., 4.}));
+        node->position({i * 10., 0.});
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+    // one node much larger than grid cells
+    auto big_node = make_node();
+    big_node->shape(Shape::Box({10000., 10.}));
+    big_node->position({500., 50.});
+    nodes.push_back(scene.root_node.add_child(big_node));
+
+    for (auto backend :
+         {SpatialIndexBackend::space_hash, SpatialIndexBackend::uniform_grid,
+          SpatialIndexBackend::bb_tree}) {
+        scene.spatial_index.backend(backend, 16.);
+        REQUIRE(scene.spatial_index.backend() == backend);
+
+        REQUIRE(
+            scene.spatial_index.query_point({500., 0.}).front() == nodes[50]);
+        REQUIRE(
+            scene.spatial_index.query_point({-4000., 50.}).front() ==
+            nodes[100]);
+        REQUIRE(scene.spatial_index.query_point({505., 0.}).empty());
+        REQUIRE(
+            scene.spatial_index
+                .query_bounding_box({-1., -1., 101., 1.}, false)
+                .size() == 11);
+        REQUIRE(
+            scene.spatial_index.query_ray({-5., 1.}, {995., 1.}).size() ==
+            100);
+        auto ray_results =
+            scene.spatial_index.query_ray({.5, -100.}, {.5, 100.});
+        REQUIRE(ray_results.size() == 2);
+        REQUIRE(ray_results[0].node == nodes[0]);
+        REQUIRE(ray_results[1].node == nodes[100]);
+        ray_results = scene.spatial_index.query_ray({5., -10.}, {15., 100.});
+        REQUIRE(ray_results.size() == 1);
+        REQUIRE(ray_results[0].node == nodes[100]);
+
+        nodes[50]->position({500., 500.});
+        scene.resolve_dirty_nodes();
+        REQUIRE(scene.spatial_index.query_point({500., 0.}).empty());
+        REQUIRE(
+            scene.spatial_index.query_point({500., 500.}).front() == nodes[50]);
+        nodes[50]->position({500., 0.});
+        scene.resolve_dirty_nodes();
+    }
+}
+
+TEST_CASE("Test nearest and radius queries", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < 50; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({2., 2.}));
+        node->position({i * 100., 0.});
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+
+    auto nearest = scene.spatial_index.query_nearest({1010., 0.}, 3);
+    REQUIRE(nearest.size() == 3);
+    REQUIRE(nearest[0] == nodes[10]);
+    REQUIRE(nearest[1] == nodes[11]);
+    REQUIRE(nearest[2] == nodes[9]);
+
+    // requesting more nodes than there are shaped nodes in the index
+    REQUIRE(scene.spatial_index.query_nearest({0., 0.}, 100).size() == 50);
+    REQUIRE(scene.spatial_index.query_nearest({0., 0.}, 5, 150.).size() == 2);
+
+    auto in_radius = scene.spatial_index.query_radius({290., 0.}, 200.);
+    REQUIRE(in_radius.size() == 4);
+    REQUIRE(in_radius[0] == nodes[3]);
+    REQUIRE(in_radius[1] == nodes[2]);
+    REQUIRE(in_radius[2] == nodes[4]);
+    REQUIRE(in_radius[3] == nodes[1]);
+}
+
+TEST_CASE("Test ray queries", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> nodes;
+    for (int i = 2; i >= 0; i--) {
+        auto node = make_node();
+        node->shape(Shape::Box({10., 10.}));
+        node->position({i * 100., 0.});
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+
+    auto hits = scene.spatial_index.query_ray({-50., 0.}, {250., 0.});
+    REQUIRE(hits.size() == 3);
+    REQUIRE(hits[0].node == nodes[2].get());
+    REQUIRE(hits[1].node == nodes[1].get());
+    REQUIRE(hits[2].node == nodes[0].get());
+    REQUIRE(hits[0].point.x == Approx(-5.));
+    REQUIRE(hits[0].normal.x == Approx(-1.));
+    REQUIRE(hits[0].normal.y == Approx(0.));
+    REQUIRE(hits[1].alpha == Approx(145. / 300.));
+
+    // crosses bounding box corner, but misses the rotated shape
+    auto diamond = make_node();
+    diamond->shape(Shape::Box({10., 10.}));
+    diamond->position({0., 500.});
+    diamond->rotation(glm::radians(45.));
+    scene.root_node.add_child(diamond);
+    REQUIRE(scene.spatial_index.query_ray({-20., 506.5}, {-5., 506.5}).empty());
+    REQUIRE(
+        scene.spatial_index.query_ray({-20., 506.5}, {20., 506.5}).size() == 1);
+
+    auto inside_hits = scene.spatial_index.query_ray({100., 0.}, {100., 50.});
+    REQUIRE(inside_hits.size() == 1);
+    REQUIRE(inside_hits[0].alpha == 0.);
+
+    // mirroring reverses winding of the transformed shape
+    auto mirrored = make_node();
+    mirrored->shape(Shape::Box({10., 10.}));
+    mirrored->position({0., -500.});
+    mirrored->scale({-1., 1.});
+    NodePtr mirrored_ptr = scene.root_node.add_child(mirrored);
+    auto mirrored_hits =
+        scene.spatial_index.query_ray({-50., -500.}, {50., -500.});
+    REQUIRE(mirrored_hits.size() == 1);
+    REQUIRE(mirrored_hits[0].node == mirrored_ptr);
+    REQUIRE(mirrored_hits[0].point.x == Approx(-5.));
+    REQUIRE(mirrored_hits[0].normal.x == Approx(-1.));
+}
+
+TEST_CASE("Test overlapping pairs query", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto make_box = [&](glm::dvec2 position, double rotation = 0.) {
+        auto node = make_node();
+        node->shape(Shape::Box({10., 10.}));
+        node->position(position);
+        node->rotation(rotation);
+        return scene.root_node.add_child(node);
+    };
+    auto a = make_box({0., 0.});
+    auto b = make_box({8., 0.});
+    // only bounding boxes overlap with `a`
+    auto c = make_box({-11., 11.}, glm::radians(45.));
+    make_box({100., 100.});
+
+    auto pairs = scene.spatial_index.query_overlapping_pairs();
+    REQUIRE(pairs.size() == 2);
+
+    pairs = scene.spatial_index.query_overlapping_pairs(true);
+    REQUIRE(pairs.size() == 1);
+    REQUIRE(pairs[0].first == a.get());
+    REQUIRE(pairs[0].second == b.get());
+
+    pairs = scene.spatial_index.query_overlapping_pairs(
+        false, [&c](const NodePtr first, const NodePtr second) {
+            return not(first == c.get() or second == c.get());
+        });
+    REQUIRE(pairs.size() == 1);
+}
+
+TEST_CASE("Test spatial data of transformed nodes", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto node = make_node();
+    node->shape(Shape::Box({4., 2.}));
+    node->scale({2., 1.});
+    node->rotation(glm::radians(90.));
+    node->position({10., 0.});
+    NodePtr box = scene.root_node.add_child(node);
+    REQUIRE(scene.spatial_index.query_point({10., 3.5}).front() == box);
+    REQUIRE(scene.spatial_index.query_point({11.5, 0.}).empty());
+
+    node = make_node();
+    node->shape(Shape::Box({2., 2.}));
+    node->rotation(glm::radians(45.));
+    NodePtr diamond = scene.root_node.add_child(node);
+    REQUIRE(scene.spatial_index.query_point({1.2, 0.}).front() == diamond);
+    // inside bounding box, but outside of the shape itself
+    REQUIRE(scene.spatial_index.query_point({1., 1.}).empty());
+    REQUIRE(
+        scene.spatial_index.query_bounding_box({0.9, 0.9, 1.1, 1.1}).size() ==
+        1);
+
+    diamond->position({100., 0.});
+    scene.resolve_dirty_nodes();
+    REQUIRE(scene.spatial_index.query_point({0., 0.}).empty());
+    REQUIRE(scene.spatial_index.query_point({100., 1.2}).front() == diamond);
+}
+
+TEST_CASE("Test non-indexable nodes", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < 5; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({2., 2.}));
+        node->indexable(false);
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+    const BoundingBox<double> far_bbox{100., 100., 101., 101.};
+    REQUIRE(scene.spatial_index.query_point({0., 0.}).empty());
+    REQUIRE(
+        scene.spatial_index.query_bounding_box_for_drawing(far_bbox).size() ==
+        5);
+
+    nodes[1]->indexable(true);
+    nodes[4]->indexable(true);
+    scene.resolve_dirty_nodes();
+    REQUIRE(scene.spatial_index.query_point({0., 0.}).size() == 2);
+    auto results = scene.spatial_index.query_bounding_box_for_drawing(far_bbox);
+    REQUIRE(results.size() == 3);
+    for (auto i : {0, 2, 3}) {
+        REQUIRE(
+            std::find(results.begin(), results.end(), nodes[i]) !=
+            results.end());
+    }
+
+    nodes[1]->indexable(false);
+    scene.resolve_dirty_nodes();
+    REQUIRE(
+        scene.spatial_index.query_bounding_box_for_drawing(far_bbox).size() ==
+        4);
+}
+
+TEST_CASE("Test spatial index snapshots", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> nodes;
+    for (int i = 0; i < 100; i++) {
+        auto node = make_node();
+        node->shape(Shape::Box({2., 2.}));
+        node->position({i * 10., 0.});
+        nodes.push_back(scene.root_node.add_child(node));
+    }
+    REQUIRE(not scene.spatial_index.snapshot());
+    scene.spatial_index.publish_snapshot();
+    const auto snapshot = scene.spatial_index.snapshot();
+    REQUIRE(snapshot->generation() == 1);
+    // root node is indexed as well
+    REQUIRE(snapshot->size() == 101);
+    REQUIRE(
+        snapshot->query_point({500., 0.}) ==
+        std::vector<NodeHandle>{nodes[50]->handle()});
+    REQUIRE(
+        snapshot->query_bounding_box({-5., -5., 105., 5.}, false).size() ==
+        11);
+
+    // Catch assertions are not thread-safe, check results afterwards
+    size_t worker_hits = 0;
+    std::thread worker([snapshot, &worker_hits]() {
+        for (int i = 0; i < 100; i++) {
+            worker_hits += snapshot->query_point({i * 10., 0.}).size();
+        }
+    });
+    for (auto& node : nodes) {
+        node->position(node->position() + glm::dvec2{0., 100.});
+    }
+    scene.resolve_dirty_nodes();
+    worker.join();
+    REQUIRE(worker_hits == 100);
+
+    REQUIRE(snapshot->query_point({500., 100.}).empty());
+    scene.spatial_index.publish_snapshot();
+    REQUIRE(scene.spatial_index.snapshot()->generation() == 2);
+    REQUIRE(
+        scene.spatial_index.snapshot()->query_point({500., 100.}) ==
+        scene.spatial_index.query_point_handles({500., 100.}));
+}
+
+TEST_CASE("Test spatial queries filtered by views", "[nodes][spatial_index]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto make_box = [](const std::unordered_set<int16_t>& views) {
+        auto node = make_node();
+        node->shape(Shape::Box({2., 2.}));
+        node->views(views);
+        return node;
+    };
+    auto node = make_box({0});
+    scene.root_node.add_child(node);
+    node = make_box({1, 2});
+    NodePtr other_views_node = scene.root_node.add_child(node);
+    // views are inherited from parent
+    node = make_node();
+    node->shape(Shape::Box({2., 2.}));
+    other_views_node->add_child(node);
+    node = make_box({2});
+    node->indexable(false);
+    scene.root_node.add_child(node);
+
+    auto query_views = [&scene](const std::unordered_set<int16_t>& views) {
+        return scene.spatial_index.query_bounding_box_for_drawing_filtered(
+            {-1., -1., 1., 1.}, views);
+    };
+    REQUIRE(query_views({0}).size() == 1);
+    REQUIRE(query_views({1}).size() == 2);
+    REQUIRE(query_views({2}).size() == 3);
+    REQUIRE(query_views({3}).empty());
+
+    other_views_node->views(std::unordered_set<int16_t>{0});
+    REQUIRE(query_views({0}).size() == 3);
+}
+
+TEST_CASE("Test parallel physics simulation", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    scene.physics_workers_count(2);
+
+    std::vector<NodePtr> bodies;
+    for (int i = 0; i < 4; i++) {
+        auto space = make_node(NodeType::space);
+        space->space.gravity({0., 10. * (i + 1)});
+        auto body = make_node(NodeType::body);
+        body->body.body_type(BodyNodeType::dynamic);
+        body->body.mass(1.);
+        body->body.moment(1.);
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Circle(1.));
+        body->add_child(hitbox);
+        bodies.push_back(space->add_child(body));
+        scene.root_node.add_child(space);
+    }
+    // collision handlers force serial simulation of that space
+    bodies[3]->parent()->space.set_collision_handler(
+        1, 2, [](const Arbiter, CollisionPair, CollisionPair) { return 1; });
+
+    std::vector<std::thread::id> callback_threads;
+    std::vector<double> callback_velocities(bodies.size());
+    for (size_t i = 0; i < bodies.size(); i++) {
+        bodies[i]->parent()->space.add_post_step_callback(
+            [&, i](const SpaceNode*) {
+                callback_threads.push_back(std::this_thread::get_id());
+                callback_velocities[i] = bodies[i]->body.velocity().y;
+            });
+    }
+    // callbacks wait for the first step, regardless of the space
+    // being simulated serially or not
+    scene.process_physics(0us);
+    REQUIRE(callback_threads.empty());
+    scene.process_physics(100ms);
+
+    REQUIRE(callback_threads.size() == 4);
+    for (const auto thread_id : callback_threads) {
+        REQUIRE(thread_id == std::this_thread::get_id());
+    }
+    for (size_t i = 0; i < bodies.size(); i++) {
+        REQUIRE(callback_velocities[i] == Approx(10. * (i + 1) * 0.01));
+    }
+    double previous_velocity = 0.;
+    for (auto& body : bodies) {
+        REQUIRE(body->body.velocity().y > previous_velocity);
+        previous_velocity = body->body.velocity().y;
+    }
+}
+
+TEST_CASE("Test physics interpolation", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    auto body = make_node(NodeType::body);
+    body->body.body_type(BodyNodeType::dynamic);
+    body->body.mass(1.);
+    body->body.moment(1.);
+    body->body.velocity({100., 0.});
+    NodePtr body_node = space->add_child(body);
+    NodePtr space_node = scene.root_node.add_child(space);
+    space_node->space.step_size(10ms);
+    space_node->space.interpolation(PhysicsInterpolation::interpolate);
+
+    // two steps are made, with 5ms left for the next frame
+    scene.process_physics(25ms);
+    space_node->space.interpolation(PhysicsInterpolation::none);
+    scene.process_physics(0us);
+    REQUIRE(body_node->position().x == Approx(2.));
+
+    space_node->space.interpolation(PhysicsInterpolation::interpolate);
+    scene.process_physics(0us);
+    REQUIRE(body_node->position().x == Approx(1.5));
+
+    space_node->space.interpolation(PhysicsInterpolation::extrapolate);
+    scene.process_physics(0us);
+    REQUIRE(body_node->position().x == Approx(2.5));
+
+    // time above the limit is dropped
+    space_node->space.interpolation(PhysicsInterpolation::none);
+    space_node->space.max_steps_per_frame(3);
+    scene.process_physics(100ms);
+    REQUIRE(body_node->position().x == Approx(5.));
+
+    // writing back smoothed pose teleports the body behind
+    space_node->space.interpolation(PhysicsInterpolation::interpolate);
+    scene.process_physics(24ms);
+    const auto smoothed_position = body_node->position();
+    REQUIRE(smoothed_position.x == Approx(6.9));
+    body_node->position(smoothed_position);
+    space_node->space.interpolation(PhysicsInterpolation::none);
+    scene.process_physics(0us);
+    REQUIRE(body_node->position() == smoothed_position);
+}
+
+TEST_CASE("Test bodies falling asleep with interpolation", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    space->space.gravity({0., 100.});
+    space->space.sleeping_threshold(0.1);
+    space->space.step_size(10ms);
+    space->space.interpolation(PhysicsInterpolation::interpolate);
+    auto ground = make_node(NodeType::body);
+    ground->body.body_type(BodyNodeType::static_);
+    ground->position({0., 10.});
+    auto ground_hitbox = make_node(NodeType::hitbox);
+    ground_hitbox->shape(Shape::Box({100., 2.}));
+    ground->add_child(ground_hitbox);
+    space->add_child(ground);
+    auto body = make_node(NodeType::body);
+    body->body.body_type(BodyNodeType::dynamic);
+    body->body.mass(1.);
+    body->body.moment(10.);
+    auto hitbox = make_node(NodeType::hitbox);
+    hitbox->shape(Shape::Box({2., 2.}));
+    body->add_child(hitbox);
+    NodePtr body_node = space->add_child(body);
+    scene.root_node.add_child(space);
+
+    // frames don't line up with steps, so most of them end up smoothed
+    for (int i = 0; i < 500 and not body_node->body.sleeping(); i++) {
+        scene.process_physics(16ms);
+    }
+    REQUIRE(body_node->body.sleeping());
+    // node is left at pose where body fell asleep, not the smoothed one
+    const auto snapshot = body_node->parent()->space.save_snapshot();
+    REQUIRE(snapshot.bodies.size() == 1);
+    const auto& state = snapshot.bodies[0];
+    REQUIRE(
+        body_node->position() ==
+        glm::dvec2{state.position.x, state.position.y});
+}
+
+TEST_CASE("Test bodies sync after simulation", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    auto moving_body = make_node(NodeType::body);
+    moving_body->body.body_type(BodyNodeType::kinematic);
+    moving_body->body.velocity({100., 0.});
+    auto child = make_node();
+    child->position({0., 10.});
+    NodePtr child_node = moving_body->add_child(child);
+    NodePtr moving_body_node = space->add_child(moving_body);
+    auto static_body = make_node(NodeType::body);
+    static_body->body.body_type(BodyNodeType::static_);
+    static_body->position({50., 50.});
+    NodePtr static_body_node = space->add_child(static_body);
+    scene.root_node.add_child(space);
+
+    REQUIRE(child_node->absolute_position() == glm::dvec2{0., 10.});
+    scene.process_physics(25ms);
+    REQUIRE(moving_body_node->position().x == Approx(2.));
+    REQUIRE(child_node->absolute_position().x == Approx(2.));
+    REQUIRE(static_body_node->position() == glm::dvec2{50., 50.});
+
+    // post-step callback sees nodes synced with the step just taken
+    NodePtr space_node = moving_body_node->parent();
+    std::optional<glm::dvec2> callback_position;
+    space_node->space.add_post_step_callback([&](const SpaceNode*) {
+        callback_position = child_node->absolute_position();
+    });
+    scene.process_physics(10ms);
+    REQUIRE(callback_position.has_value());
+    REQUIRE(callback_position->x == Approx(3.));
+    REQUIRE(callback_position->y == Approx(10.));
+
+    // other spaces see transformations of spaces simulated before them
+    auto other_space = make_node(NodeType::space);
+    NodePtr other_space_node = scene.root_node.add_child(other_space);
+    callback_position.reset();
+    other_space_node->space.add_post_step_callback([&](const SpaceNode*) {
+        callback_position = child_node->absolute_position();
+    });
+    scene.process_physics(15ms);
+    REQUIRE(callback_position.has_value());
+    REQUIRE(callback_position->x == Approx(4.));
+}
+
+TEST_CASE("Test hitbox shape updates", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    auto body = make_node(NodeType::body);
+    auto hitbox = make_node(NodeType::hitbox);
+    hitbox->shape(Shape::Circle(5.));
+    hitbox->hitbox.elasticity(0.5);
+    NodePtr hitbox_node = body->add_child(hitbox);
+    space->add_child(body);
+    NodePtr space_node = scene.root_node.add_child(space);
+
+    REQUIRE(space_node->space.query_point_neighbors({8., 0.}, 0.).empty());
+    hitbox_node->scale({2., 2.});
+    REQUIRE(space_node->space.query_point_neighbors({8., 0.}, 0.).size() == 1);
+    REQUIRE(hitbox_node->hitbox.elasticity() == 0.5);
+
+    hitbox_node->shape(Shape::Box({4., 4.}));
+    REQUIRE(space_node->space.query_point_neighbors({8., 0.}, 0.).empty());
+    hitbox_node->position({6., 0.});
+    REQUIRE(space_node->space.query_point_neighbors({8., 0.}, 0.).size() == 1);
+    REQUIRE(hitbox_node->hitbox.elasticity() == 0.5);
+}
+
+TEST_CASE("Test recorded collision events", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    std::vector<NodePtr> hitboxes;
+    for (int i = 0; i < 2; i++) {
+        auto body = make_node(NodeType::body);
+        body->body.body_type(BodyNodeType::dynamic);
+        body->body.mass(1.);
+        body->body.moment(1.);
+        body->position({i * 1.5, 0.});
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Circle(1.));
+        hitbox->hitbox.trigger_id(2 - i);
+        hitboxes.push_back(body->add_child(hitbox));
+        space->add_child(body);
+    }
+    NodePtr space_node = scene.root_node.add_child(space);
+    space_node->space.record_collision_events(1, 2, true);
+
+    scene.process_physics(20ms);
+    const auto& buffer = space_node->space.collision_events();
+    REQUIRE(buffer.events.size() == 1);
+    const auto& begin_event = buffer.events[0];
+    REQUIRE(begin_event.phase == CollisionPhase::begin);
+    REQUIRE(begin_event.hitbox_a == hitboxes[1]->handle());
+    REQUIRE(begin_event.hitbox_b == hitboxes[0]->handle());
+    REQUIRE(begin_event.body_a == hitboxes[1]->parent()->handle());
+    REQUIRE(begin_event.contact_points_count > 0);
+    REQUIRE(
+        begin_event.contact_points_offset + begin_event.contact_points_count ==
+        buffer.contact_points.size());
+
+    space_node->space.clear_collision_events();
+    REQUIRE(buffer.events.empty());
+    hitboxes[1]->parent()->position({100., 0.});
+    scene.process_physics(20ms);
+    REQUIRE(buffer.events.size() == 1);
+    REQUIRE(buffer.events[0].phase == CollisionPhase::separate);
+    REQUIRE(buffer.events[0].contact_points_count == 0);
+}
+
+TEST_CASE("Test physics queries with buffers", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    std::vector<NodePtr> hitboxes;
+    for (int i = 0; i < 3; i++) {
+        auto body = make_node(NodeType::body);
+        body->position({i * 10., 0.});
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Circle(2.));
+        hitboxes.push_back(body->add_child(hitbox));
+        space->add_child(body);
+    }
+    NodePtr space_node = scene.root_node.add_child(space);
+    auto& space_phys = space_node->space;
+
+    std::vector<RayQueryResult> ray_results;
+    space_phys.query_ray(ray_results, {-10., 0.}, {30., 0.});
+    REQUIRE(ray_results.size() == 3);
+    space_phys.query_ray(ray_results, {-10., 0.}, {5., 0.});
+    REQUIRE(ray_results.size() == 1);
+
+    auto first_hit = space_phys.query_ray_first({30., 0.}, {-10., 0.});
+    REQUIRE(first_hit.has_value());
+    REQUIRE(first_hit->hitbox_node == hitboxes[2]);
+    REQUIRE(first_hit->point.x == Approx(22.));
+    REQUIRE_FALSE(space_phys.query_ray_first({0., 5.}, {20., 5.}));
+
+    auto nearest = space_phys.query_point_nearest({13., 0.}, 10.);
+    REQUIRE(nearest.has_value());
+    REQUIRE(nearest->hitbox_node == hitboxes[1]);
+    REQUIRE(nearest->distance == Approx(1.));
+    std::vector<PointQueryResult> point_results;
+    space_phys.query_point_neighbors(point_results, {13., 0.}, 10.);
+    REQUIRE(point_results.size() == 2);
+
+    // query shape is reused between calls, also when its type changes
+    std::vector<ShapeQueryResult> shape_results;
+    space_phys.query_shape_overlaps(shape_results, Shape::Circle(11.));
+    REQUIRE(shape_results.size() == 2);
+    space_phys.query_shape_overlaps(shape_results, Shape::Circle(1.));
+    REQUIRE(shape_results.size() == 1);
+    REQUIRE(shape_results[0].hitbox_node == hitboxes[0]);
+    REQUIRE_FALSE(shape_results[0].contact_points.empty());
+    space_phys.query_shape_overlaps(shape_results, Shape::Box({50., 1.}));
+    REQUIRE(shape_results.size() == 3);
+}
+
+TEST_CASE("Test batched ray queries", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+    scene.physics_workers_count(2);
+
+    auto space = make_node(NodeType::space);
+    for (int i = 0; i < 10; i++) {
+        auto body = make_node(NodeType::body);
+        body->position({i * 10., 0.});
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Circle(2.));
+        body->add_child(hitbox);
+        space->add_child(body);
+    }
+    NodePtr space_node = scene.root_node.add_child(space);
+
+    // vertical rays, every other one passes between bodies
+    std::vector<glm::dvec2> starts;
+    std::vector<glm::dvec2> ends;
+    for (int i = 0; i < 1000; i++) {
+        const double x = (i % 20) * 5.;
+        starts.push_back({x, -10.});
+        ends.push_back({x, 10.});
+    }
+    for (const bool use_workers : {false, true}) {
+        std::vector<std::optional<RayQueryResult>> results;
+        space_node->space.query_rays_first(
+            starts, ends, results, 0., collision_bitmask_all,
+            collision_bitmask_all, collision_group_none, use_workers);
+        REQUIRE(results.size() == 1000);
+        for (int i = 0; i < 1000; i++) {
+            REQUIRE(results[i].has_value() == (i % 2 == 0));
+            if (results[i]) {
+                REQUIRE(results[i]->point.y == Approx(-2.));
+                REQUIRE(results[i]->hitbox_node->parent()->position().x ==
+                        Approx(starts[i].x));
+            }
+        }
+    }
+}
+
+TEST_CASE("Test space snapshots", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    auto space = make_node(NodeType::space);
+    space->space.gravity({0., 100.});
+    space->space.sleeping_threshold(1.);
+    auto ground = make_node(NodeType::body);
+    ground->body.body_type(BodyNodeType::static_);
+    ground->position({0., 10.});
+    auto ground_hitbox = make_node(NodeType::hitbox);
+    ground_hitbox->shape(Shape::Box({100., 2.}));
+    ground->add_child(ground_hitbox);
+    space->add_child(ground);
+
+    std::vector<NodePtr> bodies;
+    for (int i = 0; i < 5; i++) {
+        auto body = make_node(NodeType::body);
+        body->body.body_type(BodyNodeType::dynamic);
+        body->body.mass(1.);
+        body->body.moment(10.);
+        body->position({i * 0.3, i * -2.5});
+        auto hitbox = make_node(NodeType::hitbox);
+        hitbox->shape(Shape::Box({2., 2.}));
+        body->add_child(hitbox);
+        bodies.push_back(space->add_child(body));
+    }
+    NodePtr space_node = scene.root_node.add_child(space);
+    for (int i = 0; i < 10; i++) {
+        scene.process_physics(10ms);
+    }
+
+    SpaceSnapshot snapshot;
+    space_node->space.save_snapshot(snapshot);
+    REQUIRE(snapshot.bodies.size() == 5);
+    REQUIRE_FALSE(snapshot.arbiters.empty());
+    std::vector<glm::dvec2> saved_positions;
+    for (auto& body : bodies) {
+        saved_positions.push_back(body->position());
+    }
+
+    auto simulate = [&](const bool restore) {
+        if (restore) {
+            space_node->space.restore_snapshot(snapshot);
+        }
+        for (size_t i = 0; i < bodies.size(); i++) {
+            REQUIRE(bodies[i]->position() == saved_positions[i]);
+        }
+        for (int i = 0; i < 200; i++) {
+            scene.process_physics(10ms);
+        }
+        std::vector<std::pair<glm::dvec2, double>> states;
+        for (auto& body : bodies) {
+            states.emplace_back(body->position(), body->rotation());
+        }
+        return states;
+    };
+    // restored simulation continues the same way as the one
+    // that kept running after snapshot was taken
+    const auto continued_run = simulate(false);
+    REQUIRE(continued_run[4].first != saved_positions[4]);
+    for (int i = 0; i < 3; i++) {
+        REQUIRE(simulate(true) == continued_run);
+    }
+    // index is left as restored, saving again doesn't change the outcome
+    space_node->space.restore_snapshot(snapshot);
+    SpaceSnapshot resaved_snapshot;
+    space_node->space.save_snapshot(resaved_snapshot);
+    REQUIRE(resaved_snapshot.bodies.size() == snapshot.bodies.size());
+    REQUIRE(simulate(false) == continued_run);
+
+    SpaceSnapshot detached_snapshot;
+    auto detached_space = make_node(NodeType::space);
+    REQUIRE_THROWS_AS(
+        detached_space->space.save_snapshot(detached_snapshot), exception);
+}
+
+TEST_CASE("Test deterministic physics", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+
+    auto hash_value = [](uint64_t& hash, const double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        // FNV-1a
+        for (int i = 0; i < 8; i++) {
+            hash = (hash ^ ((bits >> (i * 8)) & 0xff)) * 1099511628211ull;
+        }
+    };
+
+    // two spaces with bodies bouncing between walls,
+    // simulated for 10000 steps of 1ms
+    auto run = [&](const std::vector<HighPrecisionDuration>& frames) {
+        TestingScene scene;
+        scene.deterministic_physics(true);
+        std::vector<NodePtr> spaces;
+        std::vector<NodePtr> bodies;
+        for (int s = 0; s < 2; s++) {
+            auto space = make_node(NodeType::space);
+            space->space.gravity({0., 50. * (s + 1)});
+            space->space.step_size(1ms);
+            space->space.solver_threads(4);
+            const std::array<glm::dvec2, 4> walls_positions = {
+                {{0., -30.}, {0., 30.}, {-30., 0.}, {30., 0.}}};
+            for (int w = 0; w < 4; w++) {
+                auto wall = make_node(NodeType::body);
+                wall->body.body_type(BodyNodeType::static_);
+                wall->position(walls_positions[w]);
+                auto wall_hitbox = make_node(NodeType::hitbox);
+                wall_hitbox->shape(
+                    w < 2 ? Shape::Box({62., 2.}) : Shape::Box({2., 62.}));
+                wall_hitbox->hitbox.elasticity(0.9);
+                wall->add_child(wall_hitbox);
+                space->add_child(wall);
+            }
+            for (int i = 0; i < 10; i++) {
+                auto body = make_node(NodeType::body);
+                body->body.body_type(BodyNodeType::dynamic);
+                body->body.mass(1.);
+                body->body.moment(5.);
+                body->body.velocity({10. * (i - 5), 3. * i});
+                body->position({(i % 5) * 8. - 16., (i / 5) * 8. - 8.});
+                auto hitbox = make_node(NodeType::hitbox);
+                hitbox->shape(
+                    i % 2 ? Shape::Circle(2.) : Shape::Box({3., 3.}));
+                hitbox->hitbox.elasticity(0.9);
+                body->add_child(hitbox);
+                bodies.push_back(space->add_child(body));
+            }
+            spaces.push_back(scene.root_node.add_child(space));
+        }
+
+        // spaces are simulated in order they were added,
+        // so are their post-step callbacks called
+        std::vector<int> callbacks_order;
+        bool is_callbacks_order_valid = true;
+        for (const auto frame_dt : frames) {
+            callbacks_order.clear();
+            for (int s = 1; s >= 0; s--) {
+                spaces[s]->space.add_post_step_callback(
+                    [&callbacks_order, s](const SpaceNode*) {
+                        callbacks_order.push_back(s);
+                    });
+            }
+            scene.process_physics(frame_dt);
+            is_callbacks_order_valid &=
+                std::is_sorted(callbacks_order.begin(), callbacks_order.end());
+        }
+        REQUIRE(is_callbacks_order_valid);
+
+        uint64_t hash = 14695981039346656037ull;
+        for (auto& body : bodies) {
+            hash_value(hash, body->position().x);
+            hash_value(hash, body->position().y);
+            hash_value(hash, body->rotation());
+            hash_value(hash, body->body.velocity().x);
+            hash_value(hash, body->body.velocity().y);
+            hash_value(hash, body->body.angular_velocity());
+        }
+        return hash;
+    };
+
+    // fixed steps leave some time in accumulator, it's made up
+    // with the last frame so every run makes exactly 10000 steps
+    std::vector<HighPrecisionDuration> fixed_frames(10000, 1ms);
+    fixed_frames.push_back(1ms);
+    const auto reference_hash = run(fixed_frames);
+    REQUIRE(run(fixed_frames) == reference_hash);
+
+    std::vector<HighPrecisionDuration> uneven_frames;
+    for (int i = 0; i < 5000; i++) {
+        uneven_frames.push_back(i % 2 ? 1500us : 2500us);
+    }
+    uneven_frames.push_back(1ms);
+    REQUIRE(run(uneven_frames) == reference_hash);
+
+    // steps above the limit are carried over to next frames
+    std::vector<HighPrecisionDuration> long_frames(10, 1s);
+    long_frames.push_back(1ms);
+    long_frames.resize(2000, 0us);
+    REQUIRE(run(long_frames) == reference_hash);
+}
+
+TEST_CASE("Test attaching spaces during simulation", "[nodes][physics]")
+{
+    auto engine = initialize_testing_engine();
+    TestingScene scene;
+
+    std::vector<NodePtr> bodies;
+    for (int i = 0; i < 3; i++) {
+        auto space = make_node(NodeType::space);
+        space->space.gravity({0., 10.});
+        for (CollisionTriggerId trigger_id : {1, 2}) {
+            auto body = make_node(NodeType::body);
+            body->body.mass(1.);
+            body->body.moment(1.);
+            auto hitbox = make_node(NodeType::hitbox);
+            hitbox->shape(Shape::Circle(2.));
+            hitbox->hitbox.trigger_id(trigger_id);
+            body->add_child(hitbox);
+            bodies.push_back(space->add_child(body));
+        }
+        scene.root_node.add_child(space);
+    }
+
+    // enough spaces to make registry reallocate while it's iterated
+    size_t attached_count = 0;
+    bodies[0]->parent()->space.set_collision_handler(
+        1, 2,
+        [&](const Arbiter, CollisionPair, CollisionPair) -> uint8_t {
+            for (int i = 0; i < 20; i++) {
+                auto space = make_node(NodeType::space);
+                scene.root_node.add_child(space);
+                attached_count++;
+            }
+            return 1;
+        },
+        uint8_t(CollisionPhase::begin));
+    scene.process_physics(20ms);
+
+    REQUIRE(attached_count > 0);
+    REQUIRE(scene.simulations_registry.size() == 3 + attached_count);
+    // spaces after the one with handler were still simulated
+    REQUIRE(bodies.back()->body.velocity().y > 0.);
+    scene.process_physics(20ms);
+}